@@ -2,6 +2,10 @@
 #pragma once
 
 #include <concepts>
+#include <cstddef> // byte and max_align_t
+#include <memory> // uninitialized_copy_n, uninitialized_move_n and destroy
+#include <new> // bad_alloc and placement new
+#include <type_traits>
 
 #include "collection.hpp"
 #include "memory.hpp"
@@ -11,10 +15,11 @@ namespace lox
     template
     <
         typename               TElement, 
-        typename               TIndex     = std::size_t, 
-        std::unsigned_integral TCapacity  = std::size_t
+        typename               TIndex          = std::size_t, 
+        std::unsigned_integral TCapacity       = std::size_t,
+        std::size_t            InlineCapacity  = 0
     >
-    class array : public collection<TElement, TIndex, TCapacity>
+    class array
     {
     public:
 
@@ -22,13 +27,95 @@ namespace lox
         using idx_t   = TIndex;
         using cap_t   = TCapacity;
 
+    private:
+
+        // Storage of trivially copyable elements is grown in place with realloc; anything else is moved across.
+        static constexpr bool RELOCATABLE = std::is_trivially_copyable_v<elem_t> && alignof(elem_t) <= alignof(std::max_align_t);
+
+        // Room for the first InlineCapacity elements inside the array itself, so small arrays never touch the heap.
+        struct inline_buffer
+        {
+            alignas(elem_t) std::byte bytes[sizeof(elem_t) * InlineCapacity];
+        };
+
+        struct no_inline_buffer
+        {
+        };
+
+        [[no_unique_address]] std::conditional_t<(InlineCapacity > 0), inline_buffer, no_inline_buffer> m_inline;
+
+        elem_t* inline_elements()
+        {
+            if constexpr (InlineCapacity > 0)
+            {
+                return reinterpret_cast<elem_t*>(m_inline.bytes);
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+
+        bool is_inline() const
+        {
+            return InlineCapacity > 0 && m_elements == reinterpret_cast<const elem_t*>(&m_inline);
+        }
+
+        ///
+        /// Moves the elements into storage for 'new_capacity' elements, which must hold them all.
+        ///
+        void reallocate(cap_t new_capacity)
+        {
+            if constexpr (RELOCATABLE)
+            {
+                if (!is_inline())
+                {
+                    auto* grown = static_cast<elem_t*>(std::realloc(m_elements, new_capacity * sizeof(elem_t)));
+
+                    if (!grown) throw std::bad_alloc{};
+
+                    m_elements = grown;
+                    m_capacity = new_capacity;
+
+                    return;
+                }
+            }
+
+            auto* grown = static_cast<elem_t*>(std::malloc(new_capacity * sizeof(elem_t)));
+
+            if (!grown) throw std::bad_alloc{};
+
+            std::uninitialized_move_n(m_elements, m_count, grown);
+            std::destroy_n(m_elements, m_count);
+
+            if (!is_inline()) std::free(m_elements);
+
+            m_elements = grown;
+            m_capacity = new_capacity;
+        }
+
+        ///
+        /// Destroys every element and gives the storage back, returning to the inline buffer.
+        ///
+        void release()
+        {
+            std::destroy_n(m_elements, m_count);
+
+            if (!is_inline()) std::free(m_elements);
+
+            m_elements = inline_elements();
+            m_count    = 0;
+            m_capacity = static_cast<cap_t>(InlineCapacity);
+        }
+
     protected:
 
         cap_t m_count = 0;
 
-        cap_t m_capacity = 0;
+        cap_t m_capacity = static_cast<cap_t>(InlineCapacity);
         
-        std::unique_ptr<elem_t[]> m_elements = nullptr;
+        // Only the first m_count elements are constructed; the rest of the storage is raw.
+        elem_t* m_elements = inline_elements();
 
     public:
 
@@ -42,33 +129,33 @@ namespace lox
         ///
         array(cap_t initial_capacity)
         {
-            m_capacity = initial_capacity;
-            resize_array(m_elements, static_cast<cap_t>(0), initial_capacity);
+            reserve(initial_capacity);
         }
 
         ///
-        /// Copy constructor.
+        /// Copy constructor. Copies only the elements, not the spare capacity.
         ///
         array(const array& other)
         {
-            m_count    = other.m_count;
-            m_capacity = other.m_capacity;
-            resize_array(m_elements, static_cast<cap_t>(0), other.m_capacity);
+            reserve(other.m_count);
 
-            for (cap_t i = 0; i < other.m_capacity; ++i)
-            {
-                m_elements[i] = other.m_elements[i];
-            }
+            std::uninitialized_copy_n(other.m_elements, other.m_count, m_elements);
+            m_count = other.m_count;
         }
 
         ///
         /// Copy assignment operator.
         ///
-        array& operator=(array other)
+        array& operator=(const array& other)
         {
-            std::swap(m_count,    other.m_count);
-            std::swap(m_capacity, other.m_capacity);
-            std::swap(m_elements, other.m_elements);
+            if (&other != this)
+            {
+                truncate(0);
+                reserve(other.m_count);
+
+                std::uninitialized_copy_n(other.m_elements, other.m_count, m_elements);
+                m_count = other.m_count;
+            }
 
             return *this;
         }
@@ -76,42 +163,53 @@ namespace lox
         ///
         /// Move constructor.
         ///
-        array(array&& other)
+        array(array&& other) noexcept
         {
-            m_count    = other.m_count;
-            m_capacity = other.m_capacity;
-            m_elements = other.m_elements;
-
-            other.m_count = 0;
-            other.m_capacity = 0;
-            other.m_elements = nullptr;
+            *this = std::move(other);
         }
 
         ///
         /// Move assignment operator.
         ///
-        array& operator=(array&& other)
+        array& operator=(array&& other) noexcept
         {
-            if (&other != this)
+            if (&other == this) return *this;
+
+            release();
+
+            if (other.is_inline())
             {
-                if (m_elements) free_array(m_elements, m_capacity);
+                std::uninitialized_move_n(other.m_elements, other.m_count, m_elements);
+                m_count = other.m_count;
 
+                other.truncate(0);
+            }
+            else
+            {
                 m_count    = other.m_count;
                 m_capacity = other.m_capacity;
                 m_elements = other.m_elements;
 
                 other.m_count    = 0;
-                other.m_capacity = 0;
-                other.m_elements = nullptr;
+                other.m_capacity = static_cast<cap_t>(InlineCapacity);
+                other.m_elements = other.inline_elements();
             }
 
             return *this;
         }
 
+        ///
+        /// Destructor.
+        ///
+        ~array()
+        {
+            release();
+        }
+
         ///
         /// Returns the amount of elements the array currently contains.
         ///
-        cap_t count() const override
+        cap_t count() const
         {
             return m_count;
         }
@@ -127,7 +225,7 @@ namespace lox
         ///
         /// Retrieves a reference to an element at an index.
         ///
-        elem_t& get(idx_t index) override
+        elem_t& get(idx_t index)
         {
             return m_elements[index]; 
         }
@@ -135,7 +233,7 @@ namespace lox
         ///
         /// Retrieves a const reference to an element at an index. 
         ///
-        const elem_t& get(idx_t index) const override
+        const elem_t& get(idx_t index) const
         { 
             return m_elements[index];
         }
@@ -143,19 +241,36 @@ namespace lox
         ///
         /// Adds a new element to the array and returns its index.
         ///
-        idx_t add(elem_t element) override
+        idx_t add(elem_t element)
         {
             if (m_capacity < m_count + 1)
             {
-                auto old_capacity = m_capacity;
-                auto new_capacity = m_capacity = grow_capacity(m_capacity);
-
-                resize_array(m_elements, old_capacity, new_capacity);
+                reallocate(grow_capacity(m_capacity));
             }
 
-            m_elements[m_count++] = element;
+            new (m_elements + m_count) elem_t(std::move(element));
 
-            return static_cast<idx_t>(m_count - 1);
+            return static_cast<idx_t>(m_count++);
+        }
+
+        ///
+        /// Makes room for at least 'capacity' elements without further reallocations.
+        ///
+        void reserve(cap_t capacity)
+        {
+            if (m_capacity < capacity) reallocate(capacity);
+        }
+
+        ///
+        /// Drops every element past the first 'count' ones, keeping the storage.
+        ///
+        void truncate(cap_t count)
+        {
+            if (m_count <= count) return;
+
+            std::destroy(m_elements + count, m_elements + m_count);
+
+            m_count = count;
         }
 
         ///
@@ -163,8 +278,9 @@ namespace lox
         ///
         void reset()
         {
-            m_count = m_capacity = 0;
-            m_elements.reset();
+            release();
         }
     };
+
+    static_assert(collection<array<uint8_t>>);
 }
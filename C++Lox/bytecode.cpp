@@ -0,0 +1,525 @@
+
+#include <bit>
+#include <cstdio>
+#include <cstring> // memcpy
+#include <filesystem>
+#include <random>
+
+#include "bytecode.hpp"
+
+namespace
+{
+    // Starts with a byte no Lox source can start with, so compiled scripts and sources can be told apart.
+    constexpr std::string_view MAGIC{ "\x89LOXC\r\n\x1a", 8 };
+
+    constexpr std::size_t HEADER_SIZE = 48;
+
+    // Bytes of a line run in the file.
+    constexpr std::size_t LINE_SIZE = 8;
+
+    // Fewest bytes a constant takes in the file: a tag and the length of an empty string.
+    constexpr std::size_t MIN_CONSTANT_SIZE = 5;
+
+    // Fewest bytes a global takes in the file: the length of its name.
+    constexpr std::size_t MIN_GLOBAL_SIZE = 4;
+
+    enum constant_tag : uint8_t
+    {
+        NUMBER,
+        STRING
+    };
+
+    ///
+    /// Appends little-endian integers and strings to a buffer.
+    ///
+    class writer
+    {
+        std::string& m_bytes;
+
+    public:
+
+        writer(std::string& bytes) : m_bytes{ bytes } {}
+
+        template <std::unsigned_integral T>
+        void write(T value)
+        {
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+            {
+                m_bytes.push_back(static_cast<char>(value >> (8 * i)));
+            }
+        }
+
+        void write(std::string_view text)
+        {
+            write(static_cast<uint32_t>(text.length()));
+
+            m_bytes.append(text);
+        }
+    };
+
+    ///
+    /// Reads little-endian integers and strings from a buffer. Reading past its end
+    /// yields zeros and empty strings and marks the reader as failed.
+    ///
+    class reader
+    {
+        std::string_view m_bytes;
+
+        std::size_t m_offset = 0;
+
+        bool m_failed = false;
+
+    public:
+
+        reader(std::string_view bytes) : m_bytes{ bytes } {}
+
+        template <std::unsigned_integral T>
+        T read()
+        {
+            if (m_bytes.length() - m_offset < sizeof(T))
+            {
+                m_failed = true;
+
+                return 0;
+            }
+
+            T value = 0;
+
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+            {
+                value |= static_cast<T>(static_cast<uint8_t>(m_bytes[m_offset + i])) << (8 * i);
+            }
+
+            m_offset += sizeof(T);
+
+            return value;
+        }
+
+        std::string_view read_bytes(std::size_t count)
+        {
+            if (m_bytes.length() - m_offset < count)
+            {
+                m_failed = true;
+
+                return {};
+            }
+
+            const auto bytes = m_bytes.substr(m_offset, count);
+
+            m_offset += count;
+
+            return bytes;
+        }
+
+        std::string_view read_string()
+        {
+            return read_bytes(read<uint32_t>());
+        }
+
+        bool failed() const
+        {
+            return m_failed;
+        }
+
+        bool at_end() const
+        {
+            return m_offset == m_bytes.length();
+        }
+
+        std::size_t remaining() const
+        {
+            return m_bytes.length() - m_offset;
+        }
+    };
+
+    struct file_header
+    {
+        uint16_t version            = 0;
+        uint8_t  optimization_level = 0;
+        uint64_t source_hash        = 0;
+        uint32_t code_length        = 0;
+        uint32_t line_count         = 0;
+        uint32_t constant_count     = 0;
+        uint32_t global_count       = 0;
+        uint32_t payload_length     = 0;
+        uint32_t payload_checksum   = 0;
+    };
+}
+
+///
+/// Hashes bytes eight at a time, several times faster than FNV-1a over a large source.
+/// Plenty to notice an edited script or a damaged file, though not a deliberately forged one.
+///
+static uint64_t hash_bytes(std::string_view bytes)
+{
+    constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ull;
+
+    const auto mix = [](uint64_t hash, uint64_t word) { return std::rotl((hash ^ word) * MULTIPLIER, 29); };
+
+    // Words are read as little-endian, so that files move between machines.
+    const auto word_at = [](const char* data, std::size_t length)
+    {
+        uint64_t word = 0;
+
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            std::memcpy(&word, data, length);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < length; ++i) word |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+        }
+
+        return word;
+    };
+
+    auto hash = mix(MULTIPLIER, bytes.length());
+
+    std::size_t offset = 0;
+
+    for (; bytes.length() - offset >= sizeof(uint64_t); offset += sizeof(uint64_t))
+    {
+        hash = mix(hash, word_at(bytes.data() + offset, sizeof(uint64_t)));
+    }
+
+    if (offset < bytes.length()) hash = mix(hash, word_at(bytes.data() + offset, bytes.length() - offset));
+
+    return hash ^ (hash >> 32);
+}
+
+///
+/// Returns how many values an instruction takes off the stack, or -1 if it could never be compiled.
+///
+static int stack_inputs(const uint8_t* instruction)
+{
+    switch (instruction[0])
+    {
+    case lox::op_code::OP_POP:
+    case lox::op_code::OP_DEFINE_GLOBAL_SLOT:
+    case lox::op_code::OP_DEFINE_GLOBAL_SLOT_LONG:
+    case lox::op_code::OP_NOT:
+    case lox::op_code::OP_NEGATE:
+    case lox::op_code::OP_PRINT:
+        return 1;
+
+    case lox::op_code::OP_EQUAL:
+    case lox::op_code::OP_NOT_EQUAL:
+    case lox::op_code::OP_GREATER:
+    case lox::op_code::OP_GREATER_EQUAL:
+    case lox::op_code::OP_LESS:
+    case lox::op_code::OP_LESS_EQUAL:
+    case lox::op_code::OP_ADD:
+    case lox::op_code::OP_SUBTRACT:
+    case lox::op_code::OP_MULTIPLY:
+    case lox::op_code::OP_DIVIDE:
+        return 2;
+
+    case lox::op_code::OP_CONCAT_N:
+        return instruction[1] >= 2 ? instruction[1] : -1;
+
+    default:
+        return 0;
+    }
+}
+
+///
+/// Checks that every instruction is whole and known, that it only takes values some earlier
+/// instruction left on the stack, that its operands index existing constants and global slots,
+/// and that the code ends by returning.
+///
+static bool is_valid_code(std::string_view code, const file_header& header)
+{
+    const auto* bytes = reinterpret_cast<const uint8_t*>(code.data());
+
+    uint8_t last = lox::op_code::OP_RETURN;
+
+    std::ptrdiff_t depth = 0;
+
+    for (std::size_t offset = 0; offset < code.length(); offset += lox::instruction_length(bytes[offset]))
+    {
+        const auto* instruction = bytes + offset;
+
+        last = instruction[0];
+
+        if (last > lox::op_code::OP_RETURN || code.length() - offset < lox::instruction_length(last)) return false;
+
+        const auto inputs = stack_inputs(instruction);
+
+        if (inputs < 0 || inputs > depth) return false;
+
+        depth += lox::stack_effect(instruction);
+
+        switch (last)
+        {
+        case lox::op_code::OP_CONSTANT:
+            if (instruction[1] >= header.constant_count) return false;
+            break;
+
+        case lox::op_code::OP_CONSTANT_LONG:
+            if (lox::read_long_operand(instruction + 1) >= header.constant_count) return false;
+            break;
+
+        case lox::op_code::OP_GET_GLOBAL_SLOT:
+        case lox::op_code::OP_DEFINE_GLOBAL_SLOT:
+            if (instruction[1] >= header.global_count) return false;
+            break;
+
+        case lox::op_code::OP_GET_GLOBAL_SLOT_LONG:
+        case lox::op_code::OP_DEFINE_GLOBAL_SLOT_LONG:
+            if (lox::read_long_operand(instruction + 1) >= header.global_count) return false;
+            break;
+
+        case lox::op_code::OP_ADD_GLOBALS:
+            if (instruction[1] >= header.global_count || instruction[2] >= header.global_count) return false;
+            break;
+        }
+    }
+
+    return !code.empty() && last == lox::op_code::OP_RETURN;
+}
+
+///
+/// Checks that the line runs start at the first byte and move strictly forward through the code.
+///
+static bool is_valid_lines(std::string_view lines, std::size_t code_length)
+{
+    reader in{ lines };
+
+    std::size_t previous = 0;
+
+    for (std::size_t i = 0; !in.at_end(); ++i)
+    {
+        const auto offset = in.read<uint32_t>();
+
+        in.read<uint32_t>();
+
+        if (offset >= code_length || (i == 0 ? offset != 0 : offset <= previous)) return false;
+
+        previous = offset;
+    }
+
+    return !lines.empty() && !in.failed();
+}
+
+uint64_t lox::bytecode_file::hash_source(std::string_view source)
+{
+    return hash_bytes(source);
+}
+
+bool lox::bytecode_file::is_bytecode(std::string_view bytes)
+{
+    return bytes.starts_with(MAGIC);
+}
+
+bool lox::bytecode_file::write(const std::string& path, const vm& vm, uint64_t source_hash)
+{
+    const auto& chunk = vm.m_chunk;
+    const auto& runs = chunk.lines();
+    const auto& constants = chunk.constants();
+
+    std::string payload;
+    writer out{ payload };
+
+    if (chunk.count() > 0) payload.append(reinterpret_cast<const char*>(&chunk.get(0)), chunk.count());
+
+    for (std::size_t i = 0; i < runs.count(); ++i)
+    {
+        out.write(static_cast<uint32_t>(runs.get(i).offset));
+        out.write(static_cast<uint32_t>(runs.get(i).line));
+    }
+
+    for (std::size_t i = 0; i < constants.count(); ++i)
+    {
+        const auto& constant = constants.get(static_cast<value_array::idx_t>(i));
+
+        if (constant.is_number())
+        {
+            out.write(static_cast<uint8_t>(constant_tag::NUMBER));
+            out.write(std::bit_cast<uint64_t>(constant.as_number()));
+        }
+        else if (constant.is_object() && constant.as_object()->type() == obj_type::STRING)
+        {
+            const auto* string = static_cast<const obj_string*>(constant.as_object());
+
+            out.write(static_cast<uint8_t>(constant_tag::STRING));
+            out.write(std::string_view{ string->chars(), string->length() });
+        }
+        else
+        {
+            return false; // The compiler only makes constants of numbers and strings.
+        }
+    }
+
+    for (std::size_t i = 0; i < vm.m_global_names.count(); ++i)
+    {
+        const auto* name = vm.m_global_names.get(i);
+
+        out.write(std::string_view{ name->chars(), name->length() });
+    }
+
+    if (payload.length() > std::numeric_limits<uint32_t>::max()) return false;
+
+    std::string bytes{ MAGIC };
+    writer head{ bytes };
+
+    head.write(VERSION);
+    head.write(static_cast<uint8_t>(vm.m_optimization_level));
+    head.write(static_cast<uint8_t>(0));
+    head.write(source_hash);
+    head.write(static_cast<uint32_t>(chunk.count()));
+    head.write(static_cast<uint32_t>(runs.count()));
+    head.write(static_cast<uint32_t>(constants.count()));
+    head.write(static_cast<uint32_t>(vm.m_global_names.count()));
+    head.write(static_cast<uint32_t>(payload.length()));
+    head.write(static_cast<uint32_t>(hash_bytes(payload)));
+    head.write(hash_string(bytes));
+
+    // Written aside and renamed into place, so that a run reading the file never sees it half written.
+    const auto temporary = std::format("{}.{:08x}.tmp", path, std::random_device{}());
+
+    auto* file = std::fopen(temporary.c_str(), "wb");
+
+    if (!file) return false;
+
+    const bool written = std::fwrite(bytes.data(), 1, bytes.length(), file) == bytes.length()
+        && std::fwrite(payload.data(), 1, payload.length(), file) == payload.length();
+
+    std::error_code error;
+
+    if (std::fclose(file) != 0 || !written)
+    {
+        std::filesystem::remove(temporary, error);
+
+        return false;
+    }
+
+    std::filesystem::rename(temporary, path, error);
+
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool lox::bytecode_file::load(std::string_view bytes, vm& vm, std::optional<uint64_t> source_hash)
+{
+    if (!is_bytecode(bytes) || bytes.length() < HEADER_SIZE) return false;
+
+    reader head{ bytes.substr(MAGIC.length(), HEADER_SIZE - MAGIC.length()) };
+
+    file_header header{};
+
+    header.version = head.read<uint16_t>();
+    header.optimization_level = head.read<uint8_t>();
+    head.read<uint8_t>();
+    header.source_hash = head.read<uint64_t>();
+    header.code_length = head.read<uint32_t>();
+    header.line_count = head.read<uint32_t>();
+    header.constant_count = head.read<uint32_t>();
+    header.global_count = head.read<uint32_t>();
+    header.payload_length = head.read<uint32_t>();
+    header.payload_checksum = head.read<uint32_t>();
+
+    const auto header_checksum = head.read<uint32_t>();
+
+    if (header_checksum != hash_string(bytes.substr(0, HEADER_SIZE - sizeof(uint32_t)))) return false;
+
+    if (header.version != VERSION || header.optimization_level != vm.m_optimization_level) return false;
+
+    if (source_hash.has_value() && source_hash.value() != header.source_hash) return false;
+
+    const auto payload = bytes.substr(HEADER_SIZE);
+
+    if (payload.length() != header.payload_length || static_cast<uint32_t>(hash_bytes(payload)) != header.payload_checksum) return false;
+
+    auto& chunk = vm.m_chunk;
+
+    // Constant indices and global slots are stored as the compiling VM numbered them, which a fresh VM repeats.
+    if (chunk.count() > 0 || chunk.constants().count() > 0 || vm.m_global_names.count() > 0) return false;
+
+    // Counts the payload cannot hold are rejected before anything loops over them.
+    if (header.line_count > payload.length() / LINE_SIZE) return false;
+
+    reader in{ payload };
+
+    const auto code = in.read_bytes(header.code_length);
+    const auto lines = in.read_bytes(static_cast<std::size_t>(header.line_count) * LINE_SIZE);
+    const auto pools = in;
+
+    if (in.failed() || !is_valid_code(code, header) || !is_valid_lines(lines, code.length())) return false;
+
+    if (static_cast<uint64_t>(header.constant_count) * MIN_CONSTANT_SIZE
+        + static_cast<uint64_t>(header.global_count) * MIN_GLOBAL_SIZE > in.remaining()) return false;
+
+    for (uint32_t i = 0; i < header.constant_count; ++i)
+    {
+        const auto tag = in.read<uint8_t>();
+
+        switch (tag)
+        {
+        case constant_tag::NUMBER: in.read<uint64_t>(); break;
+        case constant_tag::STRING: in.read_string();    break;
+        default: return false;
+        }
+
+        if (in.failed()) return false;
+    }
+
+    // Global names must be unique, or the VM would give the later ones the slots of the earlier.
+    table<std::string_view, bool, string_hash> names;
+
+    for (uint32_t i = 0; i < header.global_count; ++i)
+    {
+        const auto name = in.read_string();
+
+        if (in.failed() || !names.try_emplace(name, true).second) return false;
+    }
+
+    if (in.failed() || !in.at_end()) return false;
+
+    // The file is sound: fill the VM in. Each new string is reachable from the pool or the globals
+    // before the next one is allocated, so a collection in between keeps them all.
+    in = pools;
+
+    auto& constants = chunk.constants();
+
+    constants.reserve(header.constant_count);
+
+    for (uint32_t i = 0; i < header.constant_count; ++i)
+    {
+        const auto constant = in.read<uint8_t>() == constant_tag::NUMBER
+            ? value::from(std::bit_cast<double>(in.read<uint64_t>()))
+            : value::from(vm.copy_string(in.read_string()));
+
+        // The compiler already shared identical constants, so the pool is taken as it is instead of going
+        // through add_constant. Later code compiled into the chunk at worst repeats one of these.
+        constants.add(constant);
+    }
+
+    for (uint32_t i = 0; i < header.global_count; ++i)
+    {
+        vm.global_slot(vm.copy_string(in.read_string()));
+    }
+
+    chunk.reserve(header.code_length);
+
+    reader runs{ lines };
+
+    std::size_t offset = runs.read<uint32_t>();
+
+    for (uint32_t i = 0; i < header.line_count; ++i)
+    {
+        const auto line = static_cast<int>(runs.read<uint32_t>());
+        const auto end = i + 1 < header.line_count ? runs.read<uint32_t>() : code.length();
+
+        chunk.write({ reinterpret_cast<const uint8_t*>(code.data()) + offset, end - offset }, line);
+
+        offset = end;
+    }
+
+    return true;
+}
@@ -0,0 +1,49 @@
+
+#pragma once
+
+#include "common.hpp"
+#include "vm.hpp"
+
+namespace lox
+{
+    ///
+    /// Writes and loads compiled scripts (.loxc files), so that an unchanged script is not scanned
+    /// and compiled again on every run. All integers are little-endian. After a 48-byte header come:
+    ///
+    ///   code       'code_length' bytes of bytecode
+    ///   lines      'line_count' runs of { uint32 offset, int32 line }
+    ///   constants  'constant_count' of { uint8 tag, payload }: the 8 bytes of a number,
+    ///              or a uint32 length and the characters of a string
+    ///   globals    'global_count' names, each a uint32 length and the characters, in slot order
+    ///
+    class bytecode_file
+    {
+    public:
+
+        // Bump on any change to the layout or to the instruction set.
+        static constexpr uint16_t VERSION = 2;
+
+        ///
+        /// Returns the hash a compiled script records of the source it was compiled from.
+        ///
+        static uint64_t hash_source(std::string_view source);
+
+        ///
+        /// Checks whether some bytes start like a compiled script rather than like source code.
+        ///
+        static bool is_bytecode(std::string_view bytes);
+
+        ///
+        /// Writes everything compiled into a VM to a file, replacing it atomically.
+        /// Returns whether the file could be written.
+        ///
+        static bool write(const std::string& path, const vm& vm, uint64_t source_hash);
+
+        ///
+        /// Loads a compiled script into a VM that has not compiled anything yet, ready to execute from offset 0.
+        /// Returns false, with the VM untouched, unless the bytes are an intact file of this version compiled
+        /// at the VM's optimization level and, if 'source_hash' is given, from that source.
+        ///
+        static bool load(std::string_view bytes, vm& vm, std::optional<uint64_t> source_hash = std::nullopt);
+    };
+}
@@ -1,9 +1,12 @@
 
 #pragma once
 
+#include <span>
+
 #include "array.hpp"
 #include "collection.hpp"
 #include "common.hpp"
+#include "table.hpp"
 #include "value.hpp"
 
 namespace lox
@@ -12,37 +15,235 @@ namespace lox
     enum op_code : uint8_t
     {
         OP_CONSTANT,
+        OP_CONSTANT_LONG,
         OP_NIL,
         OP_TRUE,
         OP_FALSE,
         OP_POP,
-        OP_GET_GLOBAL,
-        OP_DEFINE_GLOBAL,
+        OP_GET_GLOBAL_SLOT,
+        OP_GET_GLOBAL_SLOT_LONG,
+        OP_DEFINE_GLOBAL_SLOT,
+        OP_DEFINE_GLOBAL_SLOT_LONG,
         OP_EQUAL,
+        OP_NOT_EQUAL,
         OP_GREATER,
+        OP_GREATER_EQUAL,
         OP_LESS,
+        OP_LESS_EQUAL,
         OP_ADD,
+        OP_CONCAT_N,
         OP_SUBTRACT,
         OP_MULTIPLY,
         OP_DIVIDE,
         OP_NOT,
         OP_NEGATE,
         OP_PRINT,
+        // Superinstructions, only emitted by the peephole optimizer.
+        OP_ADD_GLOBALS,
         OP_RETURN
     };
 
-    struct op_info
+    ///
+    /// Returns the size in bytes of an instruction, operands included.
+    ///
+    constexpr std::size_t instruction_length(uint8_t op)
+    {
+        switch (op)
+        {
+        case op_code::OP_CONSTANT:
+        case op_code::OP_GET_GLOBAL_SLOT:
+        case op_code::OP_DEFINE_GLOBAL_SLOT:
+        case op_code::OP_CONCAT_N:
+            return 2;
+
+        case op_code::OP_ADD_GLOBALS:
+            return 3;
+
+        case op_code::OP_CONSTANT_LONG:
+        case op_code::OP_GET_GLOBAL_SLOT_LONG:
+        case op_code::OP_DEFINE_GLOBAL_SLOT_LONG:
+            return 4;
+
+        default:
+            return 1;
+        }
+    }
+
+    ///
+    /// Returns how many values an instruction leaves on the stack minus how many it takes off.
+    ///
+    constexpr int stack_effect(const uint8_t* instruction)
+    {
+        switch (instruction[0])
+        {
+        case op_code::OP_CONSTANT:
+        case op_code::OP_CONSTANT_LONG:
+        case op_code::OP_NIL:
+        case op_code::OP_TRUE:
+        case op_code::OP_FALSE:
+        case op_code::OP_GET_GLOBAL_SLOT:
+        case op_code::OP_GET_GLOBAL_SLOT_LONG:
+        case op_code::OP_ADD_GLOBALS:
+            return 1;
+
+        case op_code::OP_POP:
+        case op_code::OP_DEFINE_GLOBAL_SLOT:
+        case op_code::OP_DEFINE_GLOBAL_SLOT_LONG:
+        case op_code::OP_EQUAL:
+        case op_code::OP_NOT_EQUAL:
+        case op_code::OP_GREATER:
+        case op_code::OP_GREATER_EQUAL:
+        case op_code::OP_LESS:
+        case op_code::OP_LESS_EQUAL:
+        case op_code::OP_ADD:
+        case op_code::OP_SUBTRACT:
+        case op_code::OP_MULTIPLY:
+        case op_code::OP_DIVIDE:
+        case op_code::OP_PRINT:
+            return -1;
+
+        case op_code::OP_CONCAT_N:
+            return 1 - instruction[1];
+
+        default:
+            return 0;
+        }
+    }
+
+    ///
+    /// Returns how far above its starting depth the stack gets while an instruction runs.
+    ///
+    constexpr int stack_peak(const uint8_t* instruction)
+    {
+        switch (instruction[0])
+        {
+        case op_code::OP_ADD_GLOBALS: return 2; // Pushes both globals, then adds.
+        default: return std::max(stack_effect(instruction), 0);
+        }
+    }
+
+    // Largest index a one-byte operand can hold; anything above needs the _LONG form of the instruction.
+    constexpr std::size_t MAX_SHORT_OPERAND = 0xff;
+
+    // Largest index a three-byte operand can hold.
+    constexpr std::size_t MAX_LONG_OPERAND = 0xffffff;
+
+    ///
+    /// Decodes a three-byte little-endian operand.
+    ///
+    constexpr std::size_t read_long_operand(const uint8_t* bytes)
     {
-        uint8_t op;
+        return static_cast<std::size_t>(bytes[0])
+            | static_cast<std::size_t>(bytes[1]) << 8
+            | static_cast<std::size_t>(bytes[2]) << 16;
+    }
+
+    // First offset of a run of bytecode emitted for the same source line
+    struct line_start
+    {
+        std::size_t offset;
         int line;
     };
 
-    class chunk : public array<op_info>
+    class chunk : public array<uint8_t>
     {
         value_array m_constants = {};
 
+        table<value, std::size_t, std::hash<value>, identical> m_constant_indices = {};
+
+        array<line_start> m_lines = {};
+
     public:
 
+        ///
+        /// Adds a constant to the pool, reusing the slot of an identical one, and returns its index.
+        ///
+        std::size_t add_constant(value constant)
+        {
+            auto [entry, inserted] = m_constant_indices.try_emplace(constant, m_constants.count());
+
+            if (inserted) m_constants.add(constant);
+
+            return *entry;
+        }
+
+        ///
+        /// Appends a byte emitted for a source line and returns its offset.
+        ///
+        idx_t write(uint8_t byte, int line)
+        {
+            if (m_lines.count() == 0 || m_lines.get(m_lines.count() - 1).line != line)
+            {
+                m_lines.add({ count(), line });
+            }
+
+            return add(byte);
+        }
+
+        ///
+        /// Appends a run of bytes emitted for the same source line and returns the offset of the first.
+        ///
+        idx_t write(std::span<const uint8_t> bytes, int line)
+        {
+            const auto offset = count();
+
+            if (bytes.empty()) return offset;
+
+            write(bytes.front(), line);
+
+            for (auto byte : bytes.subspan(1)) add(byte);
+
+            return offset;
+        }
+
+        ///
+        /// Returns a const reference to the line runs of this chunk, ordered by offset.
+        ///
+        const array<line_start>& lines() const
+        {
+            return m_lines;
+        }
+
+        ///
+        /// Drops every byte of code from an offset onwards, along with its lines.
+        ///
+        void truncate(idx_t offset)
+        {
+            array::truncate(offset);
+
+            auto runs = m_lines.count();
+
+            while (runs > 0 && m_lines.get(runs - 1).offset >= offset) --runs;
+
+            m_lines.truncate(runs);
+        }
+
+        ///
+        /// Returns the source line the byte at an offset was emitted for.
+        /// (Binary search over the line runs, meant for errors and disassembly only.)
+        ///
+        int line(idx_t offset) const
+        {
+            std::size_t low = 0;
+            std::size_t high = m_lines.count();
+
+            while (high - low > 1)
+            {
+                auto middle = low + (high - low) / 2;
+
+                if (m_lines.get(middle).offset <= offset)
+                {
+                    low = middle;
+                }
+                else
+                {
+                    high = middle;
+                }
+            }
+
+            return m_lines.count() > 0 ? m_lines.get(low).line : 0;
+        }
+
         ///
         /// Returns a reference to the array of constants of this chunk.
         ///
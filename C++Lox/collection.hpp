@@ -1,32 +1,45 @@
 
 #pragma once
 
+#include <concepts>
+
 #include "common.hpp"
 
 namespace lox
 {
-    template <typename TElement, typename TIndex = std::size_t, std::unsigned_integral TCapacity = std::size_t>
-    class collection
+    ///
+    /// An indexable container of elements that can be counted and appended to.
+    /// Checked at compile time, so containers carry no vtable and every call can be inlined.
+    ///
+    template <typename TCollection>
+    concept collection = requires
+    (
+        TCollection& collection,
+        const TCollection& const_collection,
+        typename TCollection::idx_t index,
+        typename TCollection::elem_t element
+    )
     {
-    public:
+        requires std::unsigned_integral<typename TCollection::cap_t>;
+
         ///
         /// Returns the amount of elements contained in the collection.
         ///
-        virtual TCapacity count() const = 0;
+        { const_collection.count() } -> std::same_as<typename TCollection::cap_t>;
 
         ///
         /// Retrieves a reference to an element at an index.
         ///
-        virtual TElement& get(TIndex index) = 0;
+        { collection.get(index) } -> std::same_as<typename TCollection::elem_t&>;
 
         ///
-        /// Retrieves a const reference to an element at an index. 
+        /// Retrieves a const reference to an element at an index.
         ///
-        virtual const TElement& get(TIndex index) const = 0;
+        { const_collection.get(index) } -> std::same_as<const typename TCollection::elem_t&>;
 
         ///
         /// Adds a new element to the collection and returns its index.
         ///
-        virtual TIndex add(TElement element) = 0;
+        { collection.add(element) } -> std::same_as<typename TCollection::idx_t>;
     };
 }
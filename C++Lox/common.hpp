@@ -10,3 +10,23 @@
 #include <optional>
 #include <string> // string_view
 #include <utility> // move
+
+// Pack every value into a single quiet NaN-tagged 64-bit word instead of a tagged variant.
+// Comment out to fall back to the tagged representation.
+#define NAN_BOXING
+
+// Collect garbage on every allocation to shake out missing roots.
+// #define DEBUG_STRESS_GC
+
+// Trace every mark, free and collection cycle to stdout.
+// #define DEBUG_LOG_GC
+
+// Scan the whole source into a token_buffer before parsing instead of one token at a time as the parser
+// advances. Off by default: on this tree the extra pass costs more than the buffer saves.
+// #define TOKEN_BUFFER
+
+// Dispatch vm::run through a table of label addresses (GCC/Clang computed goto) instead of a switch.
+// Define NO_COMPUTED_GOTO to build the portable switch for comparison; debug traces always use the switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO) && !defined(_DEBUG)
+#define COMPUTED_GOTO
+#endif
@@ -1,5 +1,9 @@
 
+#include <charconv> // from_chars
+
 #include "compiler.hpp"
+#include "optimizer.hpp"
+#include "vm.hpp"
 
 #ifdef _DEBUG
 #include "debug.hpp"
@@ -12,7 +16,9 @@ lox::chunk& lox::compiler::current_chunk()
 
 void lox::compiler::emit(uint8_t byte)
 {
-    current_chunk().add({ byte, m_parser.previous().line });
+    current_chunk().write(byte, m_parser.previous().line);
+
+    m_last_constant.reset();
 }
 
 void lox::compiler::emit(uint8_t first_byte, uint8_t second_byte)
@@ -23,14 +29,128 @@ void lox::compiler::emit(uint8_t first_byte, uint8_t second_byte)
 
 void lox::compiler::emit(value constant)
 {
-    emit(op_code::OP_CONSTANT, make_constant(constant));
+    const auto offset = current_chunk().count();
+
+    if (constant.is_nil())
+    {
+        emit(op_code::OP_NIL);
+    }
+    else if (constant.is_boolean())
+    {
+        emit(constant.as_boolean() ? op_code::OP_TRUE : op_code::OP_FALSE);
+    }
+    else
+    {
+        emit(op_code::OP_CONSTANT, op_code::OP_CONSTANT_LONG, make_constant(constant));
+    }
+
+    m_last_constant = { offset, constant };
 }
 
-uint8_t lox::compiler::make_constant(value value)
+void lox::compiler::emit(op_code op, op_code long_op, std::size_t index)
 {
-    // TODO have array throw when adding at max index
+    if (index <= MAX_SHORT_OPERAND)
+    {
+        emit(op, static_cast<uint8_t>(index));
+    }
+    else
+    {
+        emit(long_op);
+        emit(static_cast<uint8_t>(index & 0xff));
+        emit(static_cast<uint8_t>((index >> 8) & 0xff));
+        emit(static_cast<uint8_t>((index >> 16) & 0xff));
+    }
+}
+
+std::optional<lox::value> lox::compiler::constant_since(chunk::idx_t offset) const
+{
+    if (!m_last_constant.has_value() || m_last_constant->offset != offset) return std::nullopt;
+
+    return m_last_constant->constant;
+}
+
+void lox::compiler::fold(chunk::idx_t offset, value constant)
+{
+    current_chunk().truncate(offset);
+
+    emit(constant);
+}
+
+std::optional<lox::value> lox::compiler::fold_unary(token_type operator_type, value operand)
+{
+    switch (operator_type)
+    {
+    case token_type::BANG:
+        return value::from(operand.is_falsey());
+
+    case token_type::MINUS:
+        if (!operand.is_number()) return std::nullopt; // Left for the runtime error.
+        return value::from(-operand.as_number());
 
-    return current_chunk().constants().add(value);
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<lox::value> lox::compiler::fold_binary(token_type operator_type, value a, value b)
+{
+    switch (operator_type)
+    {
+    case token_type::EQUAL_EQUAL: return value::from(std::equal_to<value>{}(a, b));
+    case token_type::BANG_EQUAL:  return value::from(!std::equal_to<value>{}(a, b));
+    default: break;
+    }
+
+    if (operator_type == token_type::PLUS && a.is_string() && b.is_string())
+    {
+        const auto* lhs = static_cast<obj_string*>(a.as_object());
+        const auto* rhs = static_cast<obj_string*>(b.as_object());
+
+        const auto length = lhs->length() + rhs->length();
+
+        // Too long to be a string: left for the runtime error.
+        if (length > obj_string::MAX_LENGTH) return std::nullopt;
+
+        auto* text = m_arena.allocate_array<char>(length);
+
+        std::copy(lhs->chars(), lhs->chars() + lhs->length(), text);
+        std::copy(rhs->chars(), rhs->chars() + rhs->length(), text + lhs->length());
+
+        return value::from(m_vm.copy_string({ text, length }));
+    }
+
+    // Anything else must be two numbers, or it is left for the runtime error.
+    if (!a.is_number() || !b.is_number()) return std::nullopt;
+
+    const auto x = a.as_number();
+    const auto y = b.as_number();
+
+    switch (operator_type)
+    {
+    case token_type::GREATER:       return value::from(x > y);
+    case token_type::GREATER_EQUAL: return value::from(!(x < y));
+    case token_type::LESS:          return value::from(x < y);
+    case token_type::LESS_EQUAL:    return value::from(!(x > y));
+    case token_type::PLUS:          return value::from(x + y);
+    case token_type::MINUS:         return value::from(x - y);
+    case token_type::STAR:          return value::from(x * y);
+    case token_type::SLASH:         return value::from(x / y);
+    default: return std::nullopt;
+    }
+}
+
+std::size_t lox::compiler::make_constant(value value)
+{
+    auto index = current_chunk().add_constant(value);
+
+    if (index > MAX_LONG_OPERAND)
+    {
+        m_parser.error("Too many constants in one chunk.");
+
+        return 0;
+    }
+
+    return index;
 }
 
 void lox::compiler::print_statement()
@@ -102,7 +222,16 @@ void lox::compiler::expression_statement()
 
 void lox::compiler::number()
 {
-    auto number = std::stod(std::string{ m_parser.previous().text });
+    const auto text = m_parser.previous().text;
+
+    double number = 0;
+
+    // The scanner only produces well-formed literals; those too long for a double to hold
+    // are rare enough to take strtod's slower way to infinity or zero.
+    if (std::from_chars(text.data(), text.data() + text.length(), number).ec == std::errc::result_out_of_range)
+    {
+        number = std::strtod(std::string{ text }.c_str(), nullptr);
+    }
 
     emit(value::from(number));
 }
@@ -113,25 +242,21 @@ void lox::compiler::string()
 
     auto string_contents = text.substr(1, text.length() - 2);
 
-    if (m_strings.contains(string_contents))
+    if (string_contents.length() > obj_string::MAX_LENGTH)
     {
-        emit(value::from(m_strings.at(string_contents)));
-    }
-    else
-    {
-        const auto ptr = allocate_shared<obj_string>(string_contents);
-
-        m_strings[string_contents] = ptr;
+        m_parser.error("String literal is too long.");
 
-        emit(value::from(ptr));
+        return;
     }
+
+    emit(value::from(m_vm.copy_string(string_contents)));
 }
 
 void lox::compiler::named_variable(token name)
 {
-    uint8_t arg = identifier_constant(name);
+    auto arg = global_slot(name);
 
-    emit(op_code::OP_GET_GLOBAL, arg);
+    emit(op_code::OP_GET_GLOBAL_SLOT, op_code::OP_GET_GLOBAL_SLOT_LONG, arg);
 }
 
 void lox::compiler::variable()
@@ -150,8 +275,20 @@ void lox::compiler::unary()
 {
     auto operator_type = m_parser.previous().type;
 
+    const auto operand_start = current_chunk().count();
+
     parse_precedence(precedence::UNARY);
 
+    if (const auto operand = constant_since(operand_start))
+    {
+        if (const auto folded = fold_unary(operator_type, operand.value()))
+        {
+            fold(operand_start, folded.value());
+
+            return;
+        }
+    }
+
     switch (operator_type)
     {
     case token_type::BANG:  emit(op_code::OP_NOT);    break;
@@ -166,8 +303,22 @@ void lox::compiler::binary()
 
     const auto& rule = get_rule(operator_type);
 
+    // The left operand was the last thing emitted, so it is still a known constant if it was one.
+    const auto lhs = m_last_constant;
+    const auto rhs_start = current_chunk().count();
+
     parse_precedence(static_cast<precedence>(static_cast<int>(rule.precedence) + 1));
 
+    if (const auto rhs = constant_since(rhs_start); lhs.has_value() && rhs.has_value())
+    {
+        if (const auto folded = fold_binary(operator_type, lhs->constant, rhs.value()))
+        {
+            fold(lhs->offset, folded.value());
+
+            return;
+        }
+    }
+
     switch (operator_type)
     {
     case token_type::BANG_EQUAL:    emit(op_code::OP_EQUAL, op_code::OP_NOT);   break;
@@ -176,7 +327,6 @@ void lox::compiler::binary()
     case token_type::GREATER_EQUAL: emit(op_code::OP_LESS, op_code::OP_NOT);    break;
     case token_type::LESS:          emit(op_code::OP_LESS);                     break;
     case token_type::LESS_EQUAL:    emit(op_code::OP_GREATER, op_code::OP_NOT); break;
-    case token_type::PLUS:          emit(op_code::OP_ADD);                      break;
     case token_type::MINUS:         emit(op_code::OP_SUBTRACT);                 break;
     case token_type::STAR:          emit(op_code::OP_MULTIPLY);                 break;
     case token_type::SLASH:         emit(op_code::OP_DIVIDE);                   break;
@@ -184,87 +334,208 @@ void lox::compiler::binary()
     }
 }
 
+///
+/// Compiles a whole chain of '+' at once, so that 'a + b + c' can concatenate with one
+/// OP_CONCAT_N instead of allocating an intermediate string per OP_ADD.
+///
+void lox::compiler::addition()
+{
+    // The left operand was the last thing emitted, so it is still a known constant if it was one.
+    auto lhs = m_last_constant;
+
+    // Operands waiting for the OP_CONCAT_N, or zero once the chain has fallen back to OP_ADD.
+    std::size_t pending = 1;
+
+    do
+    {
+        const auto rhs_start = current_chunk().count();
+
+        parse_precedence(precedence::FACTOR);
+
+        if (const auto rhs = constant_since(rhs_start); pending == 1 && lhs.has_value() && rhs.has_value())
+        {
+            if (const auto folded = fold_binary(token_type::PLUS, lhs->constant, rhs.value()))
+            {
+                fold(lhs->offset, folded.value());
+
+                lhs = m_last_constant;
+
+                continue;
+            }
+        }
+
+        // A chain starting with a number can only add numbers or fail, so it keeps OP_ADD (and its superinstructions).
+        if (pending == 1 && lhs.has_value() && lhs->constant.is_number()) pending = 0;
+
+        if (pending == 0)
+        {
+            emit(op_code::OP_ADD);
+        }
+        else if (++pending == MAX_SHORT_OPERAND)
+        {
+            emit(op_code::OP_CONCAT_N, static_cast<uint8_t>(pending));
+
+            // The result is now the first operand of the rest of the chain.
+            pending = 1;
+            lhs.reset();
+        }
+    }
+    while (m_parser.match(token_type::PLUS));
+
+    if (pending == 2)
+    {
+        emit(op_code::OP_ADD);
+    }
+    else if (pending > 2)
+    {
+        emit(op_code::OP_CONCAT_N, static_cast<uint8_t>(pending));
+    }
+}
+
 void lox::compiler::literal()
 {
     switch (m_parser.previous().type)
     {
-    case token_type::FALSE: emit(op_code::OP_FALSE); break;
-    case token_type::NIL:   emit(op_code::OP_NIL);   break;
-    case token_type::TRUE:  emit(op_code::OP_TRUE);  break;
+    case token_type::FALSE: emit(value::from(false)); break;
+    case token_type::NIL:   emit(value::nil());       break;
+    case token_type::TRUE:  emit(value::from(true));  break;
     default: return; // Unreachable
     }
 }
 
-const lox::parse_rule& lox::compiler::get_rule(token_type type) const
+const lox::parse_rule& lox::compiler::get_rule(token_type type)
 {
-    return rules.at(type);
+    struct rule_entry
+    {
+        token_type type;
+        parse_rule rule;
+    };
+
+    // Indexed by token_type, so every token must be listed, in enum order.
+    static constexpr rule_entry rules[] =
+    {
+        { token_type::LEFT_PAREN,    { &compiler::grouping, nullptr,             precedence::NONE } },
+        { token_type::RIGHT_PAREN,   { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::LEFT_BRACE,    { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::RIGHT_BRACE,   { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::COMMA,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::DOT,           { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::MINUS,         { &compiler::unary,    &compiler::binary,   precedence::TERM } },
+        { token_type::PLUS,          { nullptr,             &compiler::addition, precedence::TERM } },
+        { token_type::SEMICOLON,     { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::SLASH,         { nullptr,             &compiler::binary,   precedence::FACTOR } },
+        { token_type::STAR,          { nullptr,             &compiler::binary,   precedence::FACTOR } },
+        { token_type::BANG,          { &compiler::unary,    nullptr,             precedence::NONE } },
+        { token_type::BANG_EQUAL,    { nullptr,             &compiler::binary,   precedence::EQUALITY } },
+        { token_type::EQUAL,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::EQUAL_EQUAL,   { nullptr,             &compiler::binary,   precedence::EQUALITY } },
+        { token_type::GREATER,       { nullptr,             &compiler::binary,   precedence::COMPARISON } },
+        { token_type::GREATER_EQUAL, { nullptr,             &compiler::binary,   precedence::COMPARISON } },
+        { token_type::LESS,          { nullptr,             &compiler::binary,   precedence::COMPARISON } },
+        { token_type::LESS_EQUAL,    { nullptr,             &compiler::binary,   precedence::COMPARISON } },
+        { token_type::IDENTIFIER,    { &compiler::variable, nullptr,             precedence::NONE } },
+        { token_type::STRING,        { &compiler::string,   nullptr,             precedence::NONE } },
+        { token_type::NUMBER,        { &compiler::number,   nullptr,             precedence::NONE } },
+        { token_type::AND,           { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::CLASS,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::ELSE,          { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::FALSE,         { &compiler::literal,  nullptr,             precedence::NONE } },
+        { token_type::FOR,           { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::FUN,           { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::IF,            { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::NIL,           { &compiler::literal,  nullptr,             precedence::NONE } },
+        { token_type::OR,            { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::PRINT,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::RETURN,        { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::SUPER,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::THIS,          { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::TRUE,          { &compiler::literal,  nullptr,             precedence::NONE } },
+        { token_type::VAR,           { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::WHILE,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::ERROR,         { nullptr,             nullptr,             precedence::NONE } },
+        { token_type::END_OF_FILE,   { nullptr,             nullptr,             precedence::NONE } },
+    };
+
+    static_assert(std::size(rules) == static_cast<std::size_t>(token_type::END_OF_FILE) + 1, "Every token type needs a parse rule.");
+
+    static_assert([]
+    {
+        for (std::size_t i = 0; i < std::size(rules); ++i)
+        {
+            if (static_cast<std::size_t>(rules[i].type) != i) return false;
+        }
+
+        return true;
+    }(), "Parse rules must be listed in token_type order.");
+
+    return rules[static_cast<std::size_t>(type)].rule;
 }
 
 void lox::compiler::parse_precedence(precedence precedence)
 {
     m_parser.advance();
 
-    const auto& prefix_rule = get_rule(m_parser.previous().type).prefix;
+    const auto prefix_rule = get_rule(m_parser.previous().type).prefix;
 
-    if (!prefix_rule.has_value())
+    if (!prefix_rule)
     {
         m_parser.error("Expect expression.");
 
         return;
     }
 
-    prefix_rule.value()();
+    (this->*prefix_rule)();
 
     while (precedence <= get_rule(m_parser.current().type).precedence)
     {
         m_parser.advance();
 
-        const auto& infix_rule = get_rule(m_parser.previous().type).infix;
+        const auto infix_rule = get_rule(m_parser.previous().type).infix;
         
-        if (infix_rule.has_value())
+        if (infix_rule)
         {
-            infix_rule.value()();
+            (this->*infix_rule)();
         }
     }
 }
 
-uint8_t lox::compiler::identifier_constant(token name)
+std::size_t lox::compiler::global_slot(token name)
 {
-    if (m_strings.contains(name.text))
-    {
-        return make_constant(value::from(m_strings.at(name.text)));
-    }
-    else
+    auto slot = m_vm.global_slot(m_vm.copy_string(name.text));
+
+    if (slot > MAX_LONG_OPERAND)
     {
-        auto blep = allocate_shared<obj_string>(name.text);
-        m_strings[name.text] = blep;
-        return make_constant(value::from(blep));
+        m_parser.error("Too many global variables.");
+
+        return 0;
     }
 
-    return make_constant(value::from(allocate_shared<obj_string>(name.text)));
+    return slot;
 }
 
-uint8_t lox::compiler::parse_variable(std::string_view message)
+std::size_t lox::compiler::parse_variable(std::string_view message)
 {
     m_parser.consume(token_type::IDENTIFIER, message);
 
-    return identifier_constant(m_parser.previous());
+    return global_slot(m_parser.previous());
 }
 
-void lox::compiler::define_variable(uint8_t global)
+void lox::compiler::define_variable(std::size_t global)
 {
-    emit(op_code::OP_DEFINE_GLOBAL, global);
+    emit(op_code::OP_DEFINE_GLOBAL_SLOT, op_code::OP_DEFINE_GLOBAL_SLOT_LONG, global);
 }
 
-lox::compiler::compiler(const std::string_view source, chunk& chunk, std::unordered_map<std::string_view, std::shared_ptr<obj_string>>& strings)
-    : m_chunk{ chunk }
+lox::compiler::compiler(const std::string_view source, vm& vm)
+    : m_vm{ vm }
+    , m_chunk{ vm.m_chunk }
     , m_parser{ source }
-    , m_strings{ strings }
 {
 }
 
 bool lox::compiler::compile()
 {
+    const auto start = m_chunk.count();
+
     m_parser.advance();
 
     while (!m_parser.match(token_type::END_OF_FILE))
@@ -276,10 +547,19 @@ bool lox::compiler::compile()
 
     emit(op_code::OP_RETURN);
 
+    if (!m_parser.had_error() && m_vm.m_optimization_level > 0)
+    {
+        peephole_optimize(m_chunk, start, m_arena);
+    }
+
+    m_arena.release();
+
 #ifdef _DEBUG
     if (!m_parser.had_error())
     {
-        disassemble_chunk(m_chunk, "code");
+        m_vm.output().flush();
+
+        disassemble_chunk(m_chunk, "code", m_vm.output());
     }
 #endif // _DEBUG
 
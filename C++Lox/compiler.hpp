@@ -1,11 +1,9 @@
 
 #pragma once
 
-#include <set>
-#include <unordered_map>
-
 #include "chunk.hpp"
 #include "common.hpp"
+#include "memory.hpp"
 #include "object.hpp"
 #include "parser.hpp"
 #include "scanner.hpp"
@@ -27,18 +25,34 @@ namespace lox
         PRIMARY
     };
 
+    class compiler;
+    class vm;
+
     struct parse_rule
     {
-        std::optional<std::function<void()>> prefix = std::nullopt;
-        std::optional<std::function<void()>> infix  = std::nullopt;
-        precedence precedence                       = precedence::NONE;
+        using parse_fn = void (compiler::*)();
+
+        parse_fn   prefix     = nullptr;
+        parse_fn   infix      = nullptr;
+        precedence precedence = precedence::NONE;
+    };
+
+    // Code offset and value of an expression known at compile time
+    struct constant_expression
+    {
+        std::size_t offset;
+        value constant;
     };
 
     class compiler
     {
+        vm& m_vm;
         chunk& m_chunk;
         parser m_parser;
-        std::unordered_map<std::string_view, std::shared_ptr<obj_string>> m_strings;
+        std::optional<constant_expression> m_last_constant;
+
+        // Scratch memory for temporaries that live until compile() returns.
+        arena m_arena;
 
         chunk& current_chunk();
 
@@ -46,7 +60,26 @@ namespace lox
         void emit(uint8_t first_byte, uint8_t second_byte);
         void emit(value constant);
 
-        uint8_t make_constant(value value);
+        ///
+        /// Emits an instruction that takes an index, switching to its three-byte form past 255.
+        ///
+        void emit(op_code op, op_code long_op, std::size_t index);
+
+        std::size_t make_constant(value value);
+
+        ///
+        /// Returns the value of the last emitted code if it is a constant expression starting at 'offset'.
+        ///
+        std::optional<value> constant_since(chunk::idx_t offset) const;
+
+        ///
+        /// Retracts the code emitted from 'offset' onwards and emits a folded constant in its place.
+        ///
+        void fold(chunk::idx_t offset, value constant);
+
+        std::optional<value> fold_unary(token_type operator_type, value operand);
+
+        std::optional<value> fold_binary(token_type operator_type, value a, value b);
 
         void print_statement();
 
@@ -74,65 +107,23 @@ namespace lox
 
         void binary();
 
+        void addition();
+
         void literal();
 
-        const parse_rule& get_rule(token_type type) const;
+        static const parse_rule& get_rule(token_type type);
 
         void parse_precedence(precedence precedence);
 
-        uint8_t identifier_constant(token name);
-
-        uint8_t parse_variable(std::string_view error_message);
-
-        void define_variable(uint8_t global);
-
-        const std::unordered_map<token_type, parse_rule> rules // sorry
-        {
-            { token_type::LEFT_PAREN,    { std::bind(&compiler::grouping, this), std::nullopt, precedence::NONE } },
-            { token_type::RIGHT_PAREN,   { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::LEFT_BRACE,    { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::RIGHT_BRACE,   { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::COMMA,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::DOT,           { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::MINUS,         { std::bind(&compiler::unary, this), std::bind(&compiler::binary, this), precedence::TERM} },
-            { token_type::PLUS,          { std::nullopt, std::bind(&compiler::binary, this), precedence::TERM} },
-            { token_type::SEMICOLON,     { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::SLASH,         { std::nullopt, std::bind(&compiler::binary, this), precedence::FACTOR} },
-            { token_type::STAR,          { std::nullopt, std::bind(&compiler::binary, this), precedence::FACTOR} },
-            { token_type::BANG,          { std::bind(&compiler::unary, this), std::nullopt, precedence::NONE } },
-            { token_type::BANG_EQUAL,    { std::nullopt, std::bind(&compiler::binary, this), precedence::EQUALITY } },
-            { token_type::EQUAL,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::EQUAL_EQUAL,   { std::nullopt, std::bind(&compiler::binary, this), precedence::EQUALITY } },
-            { token_type::GREATER,       { std::nullopt, std::bind(&compiler::binary, this), precedence::COMPARISON } },
-            { token_type::GREATER_EQUAL, { std::nullopt, std::bind(&compiler::binary, this), precedence::COMPARISON } },
-            { token_type::LESS,          { std::nullopt, std::bind(&compiler::binary, this), precedence::COMPARISON } },
-            { token_type::LESS_EQUAL,    { std::nullopt, std::bind(&compiler::binary, this), precedence::COMPARISON } },
-            { token_type::IDENTIFIER,    { std::bind(&compiler::variable, this), std::nullopt, precedence::NONE}},
-            { token_type::STRING,        { std::bind(&compiler::string, this), std::nullopt, precedence::NONE } },
-            { token_type::NUMBER,        { std::bind(&compiler::number, this), std::nullopt, precedence::NONE } },
-            { token_type::AND,           { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::CLASS,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::ELSE,          { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::FALSE,         { std::bind(&compiler::literal, this), std::nullopt, precedence::NONE}},
-            { token_type::FOR,           { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::FUN,           { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::IF,            { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::NIL,           { std::bind(&compiler::literal, this), std::nullopt, precedence::NONE } },
-            { token_type::OR,            { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::PRINT,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::RETURN,        { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::SUPER,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::THIS,          { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::TRUE,          { std::bind(&compiler::literal, this), std::nullopt, precedence::NONE } },
-            { token_type::VAR,           { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::WHILE,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::ERROR,         { std::nullopt, std::nullopt, precedence::NONE } },
-            { token_type::END_OF_FILE,   { std::nullopt, std::nullopt, precedence::NONE } },
-        };
+        std::size_t global_slot(token name);
+
+        std::size_t parse_variable(std::string_view error_message);
+
+        void define_variable(std::size_t global);
 
     public:
 
-        compiler(const std::string_view source, chunk& chunk, std::unordered_map<std::string_view, std::shared_ptr<obj_string>>& strings);
+        compiler(const std::string_view source, vm& vm);
 
         bool compile();
     };
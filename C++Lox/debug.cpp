@@ -2,29 +2,77 @@
 #include "debug.hpp"
 #include "value.hpp"
 
-void lox::disassemble_chunk(const chunk& chunk, const std::string& name)
+static void print_value(const lox::value& value, lox::output_sink& out)
+{
+    value.print(out);
+
+    out.flush();
+}
+
+void lox::disassemble_chunk(const chunk& chunk, const std::string& name, output_sink& out)
 {
     std::cout << std::format("== {} ==\n", name);
 
     for (chunk::idx_t offset = 0; offset < chunk.count();)
     {
-        offset = disassemble_instruction(chunk, offset);
+        offset = disassemble_instruction(chunk, offset, out);
     }
 }
 
-static lox::chunk::idx_t constant_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset)
+static lox::chunk::idx_t constant_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset, lox::output_sink& out)
 {
-    auto& constant_info = chunk.get(offset + 1);
+    auto constant = chunk.get(offset + 1);
     
-    std::cout << std::format("{:16} {:4} '", name, constant_info.op);
+    std::cout << std::format("{:16} {:4} '", name, constant);
     
-    chunk.constants().get(constant_info.op).print();
+    print_value(chunk.constants().get(constant), out);
     
     std::cout << "'\n";
 
     return offset + 2;
 }
 
+static lox::chunk::idx_t constant_long_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset, lox::output_sink& out)
+{
+    auto constant = lox::read_long_operand(&chunk.get(offset + 1));
+
+    std::cout << std::format("{:16} {:4} '", name, constant);
+
+    print_value(chunk.constants().get(constant), out);
+
+    std::cout << "'\n";
+
+    return offset + 4;
+}
+
+static lox::chunk::idx_t slot_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset)
+{
+    std::cout << std::format("{:16} {:4}\n", name, chunk.get(offset + 1));
+
+    return offset + 2;
+}
+
+static lox::chunk::idx_t slot_long_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset)
+{
+    std::cout << std::format("{:16} {:4}\n", name, lox::read_long_operand(&chunk.get(offset + 1)));
+
+    return offset + 4;
+}
+
+static lox::chunk::idx_t byte_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset)
+{
+    std::cout << std::format("{:16} {:4}\n", name, chunk.get(offset + 1));
+
+    return offset + 2;
+}
+
+static lox::chunk::idx_t two_slot_instruction(const std::string& name, const lox::chunk& chunk, lox::chunk::idx_t offset)
+{
+    std::cout << std::format("{:16} {:4} {:4}\n", name, chunk.get(offset + 1), chunk.get(offset + 2));
+
+    return offset + 3;
+}
+
 static lox::chunk::idx_t simple_instruction(const std::string& name, lox::chunk::idx_t offset)
 {
     std::cout << name << '\n';
@@ -32,27 +80,30 @@ static lox::chunk::idx_t simple_instruction(const std::string& name, lox::chunk:
     return offset + 1;
 }
 
-lox::chunk::idx_t lox::disassemble_instruction(const chunk& chunk, chunk::idx_t offset)
+lox::chunk::idx_t lox::disassemble_instruction(const chunk& chunk, chunk::idx_t offset, output_sink& out)
 {
     std::cout << std::format("{:0>4}", static_cast<int>(offset));
     
-    const auto& op_info = chunk.get(offset);
+    const auto line = chunk.line(offset);
 
-    if (offset > 0 && op_info.line == chunk.get(offset - 1).line)
+    if (offset > 0 && line == chunk.line(offset - 1))
     {
         std::cout << "   | ";
     }
     else
     {
-        std::cout << std::format("{:4} ", op_info.line);
+        std::cout << std::format("{:4} ", line);
     }
 
-    auto instruction = op_info.op;
+    auto instruction = chunk.get(offset);
 
     switch (instruction)
     {
     case op_code::OP_CONSTANT:
-        return constant_instruction("OP_CONSTANT", chunk, offset);
+        return constant_instruction("OP_CONSTANT", chunk, offset, out);
+
+    case op_code::OP_CONSTANT_LONG:
+        return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset, out);
 
     case op_code::OP_NIL:
         return simple_instruction("OP_NIL", offset);
@@ -66,24 +117,42 @@ lox::chunk::idx_t lox::disassemble_instruction(const chunk& chunk, chunk::idx_t
     case op_code::OP_POP:
         return simple_instruction("OP_POP", offset);
 
-    case op_code::OP_GET_GLOBAL:
-        return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+    case op_code::OP_GET_GLOBAL_SLOT:
+        return slot_instruction("OP_GET_GLOBAL_SLOT", chunk, offset);
+
+    case op_code::OP_GET_GLOBAL_SLOT_LONG:
+        return slot_long_instruction("OP_GET_GLOBAL_SLOT_LONG", chunk, offset);
 
-    case op_code::OP_DEFINE_GLOBAL:
-        return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case op_code::OP_DEFINE_GLOBAL_SLOT:
+        return slot_instruction("OP_DEFINE_GLOBAL_SLOT", chunk, offset);
+
+    case op_code::OP_DEFINE_GLOBAL_SLOT_LONG:
+        return slot_long_instruction("OP_DEFINE_GLOBAL_SLOT_LONG", chunk, offset);
 
     case op_code::OP_EQUAL:
         return simple_instruction("OP_EQUAL", offset);
+
+    case op_code::OP_NOT_EQUAL:
+        return simple_instruction("OP_NOT_EQUAL", offset);
     
     case op_code::OP_GREATER:
         return simple_instruction("OP_GREATER", offset);
 
+    case op_code::OP_GREATER_EQUAL:
+        return simple_instruction("OP_GREATER_EQUAL", offset);
+
     case op_code::OP_LESS:
         return simple_instruction("OP_LESS", offset);
 
+    case op_code::OP_LESS_EQUAL:
+        return simple_instruction("OP_LESS_EQUAL", offset);
+
     case op_code::OP_ADD:
         return simple_instruction("OP_ADD", offset);
 
+    case op_code::OP_CONCAT_N:
+        return byte_instruction("OP_CONCAT_N", chunk, offset);
+
     case op_code::OP_SUBTRACT:
         return simple_instruction("OP_SUBTRACT", offset);
 
@@ -102,6 +171,9 @@ lox::chunk::idx_t lox::disassemble_instruction(const chunk& chunk, chunk::idx_t
     case op_code::OP_PRINT:
         return simple_instruction("OP_PRINT", offset);
 
+    case op_code::OP_ADD_GLOBALS:
+        return two_slot_instruction("OP_ADD_GLOBALS", chunk, offset);
+
     case op_code::OP_RETURN:
         return simple_instruction("OP_RETURN", offset);
 
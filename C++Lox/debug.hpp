@@ -2,10 +2,15 @@
 #pragma once
 
 #include "chunk.hpp"
+#include "output.hpp"
 
 namespace lox
 {
-    void disassemble_chunk(const chunk& chunk, const std::string& name);
+    ///
+    /// Lists every instruction of a chunk on std::cout. Constants are printed through 'out',
+    /// which is flushed after each one so that it lands in its place in the listing.
+    ///
+    void disassemble_chunk(const chunk& chunk, const std::string& name, output_sink& out);
 
-    chunk::idx_t disassemble_instruction(const chunk& chunk, chunk::idx_t offset);
+    chunk::idx_t disassemble_instruction(const chunk& chunk, chunk::idx_t offset, output_sink& out);
 }
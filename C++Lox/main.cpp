@@ -1,35 +1,104 @@
 
-#include <fstream>
-#include <streambuf>
+#include <filesystem>
 
+#include "bytecode.hpp"
 #include "chunk.hpp"
 #include "common.hpp"
 #include "debug.hpp"
+#include "source.hpp"
 #include "vm.hpp"
 
+// How run_file treats compiled scripts.
+struct file_options
+{
+    // Write the compiled script instead of running it.
+    bool compile_only = false;
+
+    // Reuse and refresh the compiled script kept next to a source file.
+    bool use_cache = true;
+
+    // Where a compiled script is written; defaults to the source path with its extension replaced by ".loxc".
+    std::optional<std::string> output{};
+};
+
+int usage();
+
 int repl(lox::vm&);
 
-int run_file(lox::vm&, const std::string&);
+int run_file(lox::vm&, const std::string&, const file_options&);
 
 int main(int argc, char* argv[])
 {
-    lox::chunk chunk{};
-    lox::vm vm{ chunk };
+    std::optional<std::string> path{};
 
-    if (argc == 1)
-    {
-        return repl(vm);
-    }
-    else if (argc == 2)
-    {
-        return run_file(vm, argv[1]);
-    }
-    else
+    file_options options{};
+
+    int optimization_level = 1;
+
+    bool background_output = false;
+
+    bool heap_allocator = false;
+
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: clox [path]\n";
+        const std::string_view argument{ argv[i] };
 
-        return 64;
+        if (argument == "-O0" || argument == "-O1")
+        {
+            optimization_level = argument[2] - '0';
+        }
+        else if (argument == "--background-output")
+        {
+            background_output = true;
+        }
+        else if (argument == "--heap-allocator")
+        {
+            heap_allocator = true;
+        }
+        else if (argument == "--compile-only")
+        {
+            options.compile_only = true;
+        }
+        else if (argument == "--no-cache")
+        {
+            options.use_cache = false;
+        }
+        // "-" would be standard input to the code that checks what is already at the output path.
+        else if (argument == "-o" && i + 1 < argc && std::string_view{ argv[i + 1] } != "-" && !options.output.has_value())
+        {
+            options.output = argv[++i];
+        }
+        else if (!path.has_value() && (argument == "-" || !argument.starts_with('-')))
+        {
+            path = argument;
+        }
+        else
+        {
+            return usage();
+        }
     }
+
+    lox::chunk chunk{};
+
+    // Objects come from the VM's own pool unless asked to go straight to the heap, for comparison.
+    auto vm = heap_allocator
+        ? lox::vm{ chunk, lox::heap_allocator::instance() }
+        : lox::vm{ chunk };
+
+    vm.set_optimization_level(optimization_level);
+    vm.output().set_background(background_output);
+
+    // Compiling needs a script, and a script read from standard input has no default output path.
+    if (options.compile_only && (!path.has_value() || (path == "-" && !options.output.has_value()))) return usage();
+
+    return path.has_value() ? run_file(vm, path.value(), options) : repl(vm);
+}
+
+static int usage()
+{
+    std::cerr << "Usage: clox [-O0|-O1] [--background-output] [--heap-allocator] [--no-cache] [--compile-only] [-o output] [path|-]\n";
+
+    return 64;
 }
 
 static int repl(lox::vm& vm)
@@ -38,6 +107,8 @@ static int repl(lox::vm& vm)
 
     while (true)
     {
+        vm.output().flush();
+
         std::cout << "> ";
 
         if (!std::getline(std::cin, line))
@@ -52,16 +123,106 @@ static int repl(lox::vm& vm)
     return 0;
 }
 
-static int run_file(lox::vm& vm, const std::string& path)
+static int exit_code(lox::interpret_result result)
 {
-    std::ifstream file_stream{ path };
-
-    std::string source{ std::istreambuf_iterator<char>{ file_stream }, {} };
-
-    auto result = vm.interpret(source);
-
     if (result == lox::interpret_result::COMPILE_ERROR) return 65;
     if (result == lox::interpret_result::RUNTIME_ERROR) return 70;
 
     return 0;
 }
+
+static int run_file(lox::vm& vm, const std::string& path, const file_options& options)
+{
+    const lox::source_file source{ path };
+
+    if (!source.is_open())
+    {
+        std::cerr << std::format("Could not read file \"{}\".\n", path);
+
+        return 74;
+    }
+
+    if (lox::bytecode_file::is_bytecode(source.text()))
+    {
+        if (options.compile_only)
+        {
+            std::cerr << std::format("\"{}\" is already compiled.\n", path);
+
+            return 65;
+        }
+
+        if (!lox::bytecode_file::load(source.text(), vm))
+        {
+            std::cerr << std::format("\"{}\" is not a valid compiled script for this version and optimization level.\n", path);
+
+            return 65;
+        }
+
+        return exit_code(vm.execute(0));
+    }
+
+    // Standard input has no place to keep a compiled script next to it.
+    const bool use_cache = options.use_cache && !options.compile_only && path != "-";
+
+    if (!use_cache && !options.compile_only)
+    {
+        if (!vm.compile(source.text())) return 65;
+
+        return exit_code(vm.execute(0));
+    }
+
+    const auto hash = lox::bytecode_file::hash_source(source.text());
+    const auto output = options.output.value_or(std::filesystem::path{ path }.replace_extension(".loxc").string());
+
+    // Only a path given with -o is written over whatever is there; the default one only replaces a compiled script.
+    bool can_write = true;
+
+    // Compiling to a path given with -o needs neither the cached script nor a look at what is there.
+    if (use_cache || !options.output.has_value())
+    {
+        const lox::source_file existing{ output };
+
+        if (existing.is_open())
+        {
+            if (use_cache && lox::bytecode_file::load(existing.text(), vm, hash)) return exit_code(vm.execute(0));
+
+            can_write = options.output.has_value() || lox::bytecode_file::is_bytecode(existing.text());
+        }
+        else
+        {
+            std::error_code error;
+
+            can_write = options.output.has_value() || std::filesystem::status(output, error).type() == std::filesystem::file_type::not_found;
+        }
+    }
+
+    if (!vm.compile(source.text())) return 65;
+
+    if (options.compile_only)
+    {
+        if (!can_write)
+        {
+            std::cerr << std::format("Not replacing \"{}\", which is not a compiled script. Use -o to choose the output.\n", output);
+
+            return 74;
+        }
+
+        if (lox::bytecode_file::write(output, vm, hash)) return 0;
+
+        std::cerr << std::format("Could not write file \"{}\".\n", output);
+
+        return 74;
+    }
+
+    // A cache that cannot be written only costs the next run a compile, so the script still runs.
+    if (use_cache && !can_write)
+    {
+        std::cerr << std::format("Not caching the compiled script: \"{}\" exists and is not one.\n", output);
+    }
+    else if (use_cache && !lox::bytecode_file::write(output, vm, hash))
+    {
+        std::cerr << std::format("Could not write the compiled script cache \"{}\".\n", output);
+    }
+
+    return exit_code(vm.execute(0));
+}
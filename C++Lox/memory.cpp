@@ -0,0 +1,187 @@
+#include "memory.hpp"
+
+#include <cstddef> // byte and max_align_t
+
+// Every block is aligned for any object type.
+static constexpr std::size_t ALIGNMENT = alignof(std::max_align_t);
+
+static constexpr std::size_t align_up(std::size_t bytes)
+{
+    return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+void* lox::heap_allocator::allocate(std::size_t bytes)
+{
+    return ::operator new(bytes);
+}
+
+void lox::heap_allocator::deallocate(void* pointer, std::size_t)
+{
+    ::operator delete(pointer);
+}
+
+lox::heap_allocator& lox::heap_allocator::instance()
+{
+    static heap_allocator instance;
+
+    return instance;
+}
+
+lox::pool_allocator::pool_allocator()
+{
+    for (std::size_t i = 0; i < BLOCK_SIZES.size(); ++i)
+    {
+        m_stats[i].block_size = BLOCK_SIZES[i];
+    }
+}
+
+lox::pool_allocator::~pool_allocator()
+{
+    while (m_slabs)
+    {
+        auto* next = m_slabs->next;
+
+        ::operator delete(m_slabs);
+
+        m_slabs = next;
+    }
+}
+
+std::size_t lox::pool_allocator::size_class(std::size_t bytes)
+{
+    // Indexed by the size in 16-byte units, rounded up.
+    static constexpr auto classes = []
+    {
+        std::array<uint8_t, BLOCK_SIZES.back() / 16 + 1> classes{};
+
+        for (std::size_t units = 0, size_class = 0; units < classes.size(); ++units)
+        {
+            while (BLOCK_SIZES[size_class] < units * 16) ++size_class;
+
+            classes[units] = static_cast<uint8_t>(size_class);
+        }
+
+        return classes;
+    }();
+
+    return bytes > BLOCK_SIZES.back() ? BLOCK_SIZES.size() : classes[(bytes + 15) / 16];
+}
+
+void lox::pool_allocator::refill(std::size_t size_class)
+{
+    const auto block_size = BLOCK_SIZES[size_class];
+
+    auto* memory = static_cast<std::byte*>(::operator new(SLAB_SIZE));
+
+    auto* new_slab = reinterpret_cast<slab*>(memory);
+    new_slab->next = m_slabs;
+    m_slabs = new_slab;
+
+    // Carve the rest of the slab into blocks, pushed in reverse so they are handed out in address order.
+    const auto first = align_up(sizeof(slab));
+    const auto count = (SLAB_SIZE - first) / block_size;
+
+    for (auto i = count; i-- > 0;)
+    {
+        auto* block = reinterpret_cast<free_block*>(memory + first + i * block_size);
+
+        block->next = m_free_lists[size_class];
+        m_free_lists[size_class] = block;
+    }
+
+    m_stats[size_class].reserved_bytes += SLAB_SIZE;
+}
+
+void* lox::pool_allocator::allocate(std::size_t bytes)
+{
+    const auto index = size_class(bytes);
+    auto& stats = m_stats[index];
+
+    ++stats.allocations;
+    stats.live_bytes += bytes;
+
+    if (index == BLOCK_SIZES.size())
+    {
+        stats.reserved_bytes += bytes;
+
+        return ::operator new(bytes);
+    }
+
+    if (!m_free_lists[index]) refill(index);
+
+    auto* block = m_free_lists[index];
+    m_free_lists[index] = block->next;
+
+    return block;
+}
+
+void lox::pool_allocator::deallocate(void* pointer, std::size_t bytes)
+{
+    const auto index = size_class(bytes);
+    auto& stats = m_stats[index];
+
+    ++stats.deallocations;
+    stats.live_bytes -= bytes;
+
+    if (index == BLOCK_SIZES.size())
+    {
+        stats.reserved_bytes -= bytes;
+
+        ::operator delete(pointer);
+
+        return;
+    }
+
+    auto* block = static_cast<free_block*>(pointer);
+    block->next = m_free_lists[index];
+    m_free_lists[index] = block;
+}
+
+const lox::pool_allocator::stats_t& lox::pool_allocator::stats() const
+{
+    return m_stats;
+}
+
+lox::arena::~arena()
+{
+    release();
+}
+
+void* lox::arena::allocate(std::size_t bytes)
+{
+    bytes = align_up(bytes);
+
+    if (!m_blocks || m_blocks->capacity - m_blocks->used < bytes)
+    {
+        const auto capacity = std::max(bytes, BLOCK_SIZE);
+
+        auto* new_block = static_cast<block*>(::operator new(align_up(sizeof(block)) + capacity));
+        new_block->next = m_blocks;
+        new_block->capacity = capacity;
+        new_block->used = 0;
+
+        m_blocks = new_block;
+    }
+
+    auto* memory = reinterpret_cast<std::byte*>(m_blocks) + align_up(sizeof(block)) + m_blocks->used;
+
+    m_blocks->used += bytes;
+
+    return memory;
+}
+
+void lox::arena::deallocate(void*, std::size_t)
+{
+}
+
+void lox::arena::release()
+{
+    while (m_blocks)
+    {
+        auto* next = m_blocks->next;
+
+        ::operator delete(m_blocks);
+
+        m_blocks = next;
+    }
+}
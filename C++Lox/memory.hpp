@@ -1,6 +1,9 @@
 
 #pragma once
 
+#include <array>
+#include <memory> // destroy_n and uninitialized_value_construct_n
+
 #include "common.hpp"
 
 namespace lox
@@ -15,64 +18,189 @@ namespace lox
     }
 
     ///
-    /// Resizes an array from a capacity of 'old_count' to 'new_count'.
+    /// Source of raw memory for heap objects and compiler temporaries.
+    /// Callers pass the size back when deallocating, so implementations need no per-block header.
     ///
-    template
-    <
-        typename TArrayElement,
-        std::unsigned_integral TCapacity = std::size_t
-    >
-    static inline void resize_array(std::unique_ptr<TArrayElement[]>& old_ptr, TCapacity old_count, TCapacity new_count)
+    class allocator
+    {
+    public:
+
+        virtual ~allocator() = default;
+
+        virtual void* allocate(std::size_t bytes) = 0;
+
+        virtual void deallocate(void* pointer, std::size_t bytes) = 0;
+    };
+
+    ///
+    /// Allocator backed directly by the global heap.
+    ///
+    class heap_allocator final : public allocator
+    {
+    public:
+
+        void* allocate(std::size_t bytes) final;
+
+        void deallocate(void* pointer, std::size_t bytes) final;
+
+        static heap_allocator& instance();
+    };
+
+    ///
+    /// Destroys the elements of an array from allocate_array and gives its memory back to the heap allocator.
+    ///
+    template <typename TArrayElement>
+    struct array_deleter
     {
-        auto new_ptr = std::make_unique<TArrayElement[]>(new_count);
+        std::size_t count = 0;
 
-        for (TCapacity i = 0, max_i = std::min(old_count, new_count); i < max_i; ++i)
+        void operator()(TArrayElement* elements) const
         {
-            std::swap(old_ptr[i], new_ptr[i]);
+            std::destroy_n(elements, count);
+
+            heap_allocator::instance().deallocate(elements, count * sizeof(TArrayElement));
         }
+    };
 
-        std::swap(old_ptr, new_ptr);
-    }
+    template <typename TArrayElement>
+    using unique_array = std::unique_ptr<TArrayElement[], array_deleter<TArrayElement>>;
 
     ///
-    /// Creates a unique pointer to a new array with a capacity of 'count'.
-    /// (Wrapper for make_unique.)
+    /// Creates an array of 'count' value-initialized elements in memory from the heap allocator.
     ///
     template
     <
         typename TArrayElement,
         std::unsigned_integral TCapacity = std::size_t
     >
-    static inline std::unique_ptr<TArrayElement[]> allocate_array(TCapacity count)
+    static inline unique_array<TArrayElement> allocate_array(TCapacity count)
     {
-        return std::make_unique<TArrayElement[]>(count);
+        auto* elements = static_cast<TArrayElement*>(heap_allocator::instance().allocate(count * sizeof(TArrayElement)));
+
+        std::uninitialized_value_construct_n(elements, count);
+
+        return unique_array<TArrayElement>{ elements, array_deleter<TArrayElement>{ count } };
     }
 
     ///
-    /// Creates a shared pointer.
-    /// (Wrapper for make_shared.)
+    /// Allocation counters for one size class of a pool_allocator.
     ///
-    template
-    <
-        typename TElement,
-        typename... TArgs
-    >
-    static inline std::shared_ptr<TElement> allocate_shared(TArgs&&... args)
+    struct size_class_stats
     {
-        return std::make_shared<TElement>(std::forward<TArgs>(args)...);
-    }
+        // Size of every block in the class; 0 for the class of allocations too large to pool.
+        std::size_t block_size = 0;
+
+        std::size_t allocations = 0;
+
+        std::size_t deallocations = 0;
+
+        // Bytes requested by the blocks currently handed out.
+        std::size_t live_bytes = 0;
+
+        // Bytes taken from the heap for this class, including blocks waiting on the free list.
+        std::size_t reserved_bytes = 0;
+    };
 
     ///
-    /// Creates a unique pointer.
-    /// (Wrapper for make_unique.)
+    /// Allocator that serves small blocks from per-size-class free lists carved out of larger slabs,
+    /// and forwards anything bigger to the heap. Not thread-safe: each VM owns one, so interpreters
+    /// running side by side never contend for it.
     ///
-    template
-    <
-        typename TElement,
-        typename... TArgs
-    >
-    static inline std::unique_ptr<TElement> allocate_unique(TArgs&&... args)
+    class pool_allocator final : public allocator
     {
-        return std::make_unique<TElement>(std::forward<TArgs>(args)...);
-    }
+    public:
+
+        static constexpr std::array<std::size_t, 10> BLOCK_SIZES = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+
+        static constexpr std::size_t SLAB_SIZE = 16 * 1024;
+
+        // Size classes in BLOCK_SIZES order, followed by the large allocations.
+        using stats_t = std::array<size_class_stats, BLOCK_SIZES.size() + 1>;
+
+    private:
+
+        struct free_block
+        {
+            free_block* next;
+        };
+
+        struct slab
+        {
+            slab* next;
+        };
+
+        std::array<free_block*, BLOCK_SIZES.size()> m_free_lists = {};
+
+        slab* m_slabs = nullptr;
+
+        stats_t m_stats = {};
+
+        static std::size_t size_class(std::size_t bytes);
+
+        void refill(std::size_t size_class);
+
+    public:
+
+        pool_allocator();
+
+        pool_allocator(const pool_allocator& other) = delete;
+
+        pool_allocator& operator=(const pool_allocator& other) = delete;
+
+        ~pool_allocator();
+
+        void* allocate(std::size_t bytes) final;
+
+        void deallocate(void* pointer, std::size_t bytes) final;
+
+        const stats_t& stats() const;
+    };
+
+    ///
+    /// Bump allocator for temporaries that all die together. Deallocating does nothing;
+    /// release() hands every block back to the heap at once.
+    ///
+    class arena final : public allocator
+    {
+        static constexpr std::size_t BLOCK_SIZE = 4096;
+
+        struct block
+        {
+            block* next;
+            std::size_t capacity;
+            std::size_t used;
+        };
+
+        block* m_blocks = nullptr;
+
+    public:
+
+        arena() = default;
+
+        arena(const arena& other) = delete;
+
+        arena& operator=(const arena& other) = delete;
+
+        ~arena();
+
+        void* allocate(std::size_t bytes) final;
+
+        void deallocate(void* pointer, std::size_t bytes) final;
+
+        ///
+        /// Allocates uninitialized room for 'count' elements of a trivial type.
+        ///
+        template <typename TElement>
+        TElement* allocate_array(std::size_t count)
+        {
+            static_assert(std::is_trivially_destructible_v<TElement>, "Arena memory is never destroyed element by element.");
+
+            return static_cast<TElement*>(allocate(count * sizeof(TElement)));
+        }
+
+        ///
+        /// Frees every block allocated so far.
+        ///
+        void release();
+    };
 }
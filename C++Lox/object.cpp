@@ -1,17 +1,35 @@
 
 #include "object.hpp"
 
-#include "memory.hpp"
+#include <new> // placement new
+
 #include "vm.hpp"
 
-lox::obj_string::obj_string(std::string_view text)
+lox::obj_string::obj_string(std::string_view text, uint32_t hash)
     : obj{ obj_type::STRING }
+    , m_length{ static_cast<uint32_t>(text.length()) }
+    , m_hash{ hash }
+{
+    auto* characters = chars();
+
+    std::copy(text.cbegin(), text.cend(), characters);
+    characters[m_length] = '\0';
+}
+
+lox::obj_string* lox::obj_string::create(allocator& allocator, std::string_view text, uint32_t hash)
+{
+    auto* memory = allocator.allocate(sizeof(obj_string) + text.length() + 1);
+
+    return new (memory) obj_string(text, hash);
+}
+
+void lox::obj_string::destroy(allocator& allocator, obj_string* string)
 {
-    m_length = text.length();
-    m_chars = allocate_array<char>(text.length() + 1);
-    m_chars[m_length] = '\0';
+    const auto size = string->size();
 
-    std::copy(text.cbegin(), text.cend(), m_chars.get());
+    string->~obj_string();
+
+    allocator.deallocate(string, size);
 }
 
 std::size_t lox::obj_string::length() const
@@ -21,23 +39,76 @@ std::size_t lox::obj_string::length() const
 
 char* lox::obj_string::chars() const
 {
-    return m_chars.get();
+    // The characters start right past the header.
+    return const_cast<char*>(reinterpret_cast<const char*>(this + 1));
+}
+
+uint32_t lox::obj_string::hash() const
+{
+    return m_hash;
+}
+
+std::size_t lox::obj_string::size() const
+{
+    return sizeof(obj_string) + m_length + 1;
+}
+
+void lox::obj_string::print(output_sink& out) const
+{
+    out.put('"');
+    out.write({ chars(), m_length });
+    out.put('"');
+}
+
+lox::obj_rope::obj_rope(obj* left, obj* right)
+    : obj{ obj_type::ROPE }
+    , m_length{ string_length(left) + string_length(right) }
+    , m_left{ left }
+    , m_right{ right }
+{
+}
+
+lox::obj_rope* lox::obj_rope::create(allocator& allocator, obj* left, obj* right)
+{
+    return new (allocator.allocate(sizeof(obj_rope))) obj_rope(left, right);
+}
+
+void lox::obj_rope::destroy(allocator& allocator, obj_rope* rope)
+{
+    rope->~obj_rope();
+
+    allocator.deallocate(rope, sizeof(obj_rope));
 }
 
-void lox::obj_string::concat(const obj_string& other)
+std::size_t lox::obj_rope::length() const
 {
-    auto old_length = m_length;
-    auto new_length = m_length = old_length + other.m_length;
+    return m_length;
+}
 
-    lox::resize_array(m_chars, old_length, new_length + 1);
-    m_chars[new_length] = '\0';
+lox::obj_string* lox::obj_rope::flat() const
+{
+    return m_flat;
+}
 
-    std::copy(other.m_chars.get(), other.m_chars.get() + other.m_length, m_chars.get() + old_length);
+void lox::obj_rope::flatten(obj_string* flat)
+{
+    m_flat = flat;
+    m_left = nullptr;
+    m_right = nullptr;
 }
 
-void lox::obj_string::print() const
+std::size_t lox::obj_rope::size() const
 {
-    std::cout << '"' << m_chars << '"';
+    return sizeof(obj_rope);
+}
+
+void lox::obj_rope::print(output_sink& out) const
+{
+    out.put('"');
+
+    for_each_piece([&out](std::string_view piece) { out.write(piece); });
+
+    out.put('"');
 }
 
 lox::obj::obj(obj_type type)
@@ -49,3 +120,23 @@ lox::obj_type lox::obj::type() const
 {
     return m_type;
 }
+
+std::size_t lox::obj::size() const
+{
+    switch (m_type)
+    {
+    case obj_type::STRING: return static_cast<const obj_string*>(this)->size();
+    case obj_type::ROPE:   return static_cast<const obj_rope*>(this)->size();
+    }
+
+    return 0; // Unreachable.
+}
+
+void lox::obj::print(output_sink& out) const
+{
+    switch (m_type)
+    {
+    case obj_type::STRING: static_cast<const obj_string*>(this)->print(out); break;
+    case obj_type::ROPE:   static_cast<const obj_rope*>(this)->print(out);   break;
+    }
+}
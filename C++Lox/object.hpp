@@ -2,42 +2,80 @@
 #pragma once
 
 #include "common.hpp"
+#include "memory.hpp"
+#include "output.hpp"
+#include "stack.hpp"
 
 namespace lox
 {
     class value;
 
-    enum class obj_type
+    enum class obj_type : uint8_t
     {
-        STRING
+        STRING,
+        ROPE
     };
 
+    ///
+    /// Common header of every heap object. There is no vtable: operations dispatch on m_type,
+    /// and each object type provides static create() and destroy() for the collector, which
+    /// take the allocator the object lives in.
+    ///
     class obj
     {
     protected:
 
+        obj* m_next = nullptr;
+
         obj_type m_type;
 
+        bool m_is_marked = false;
+
         obj(obj_type type);
 
     public:
 
         obj_type type() const;
 
-        virtual void print() const = 0;
+        ///
+        /// Returns the amount of heap bytes owned by this object, as accounted by the collector.
+        ///
+        std::size_t size() const;
+
+        void print(output_sink& out) const;
 
         template <typename T> friend struct std::equal_to;
+
+        friend class vm;
     };
 
+    ///
+    /// An immutable string. The characters (and a terminating null) follow the header in the
+    /// same allocation, so a string is one block and one pointer chase.
+    ///
     class obj_string final : public obj
     {
-        std::size_t m_length = 0;
+        uint32_t m_length = 0;
+
+        // FNV-1a of the characters, computed once so that table lookups never rehash.
+        uint32_t m_hash = 0;
 
-        std::unique_ptr<char[]> m_chars = nullptr;
+        obj_string(std::string_view text, uint32_t hash);
+
+        ~obj_string() = default;
 
     public:
 
-        obj_string(std::string_view text);
+        // Longest string the 32-bit length can hold. Whatever builds strings from unbounded input
+        // must report anything longer rather than create it.
+        static constexpr std::size_t MAX_LENGTH = UINT32_MAX;
+
+        ///
+        /// Allocates a string and its characters as a single block. 'text' must be at most MAX_LENGTH long.
+        ///
+        static obj_string* create(allocator& allocator, std::string_view text, uint32_t hash);
+
+        static void destroy(allocator& allocator, obj_string* string);
 
         obj_string(const obj_string& other) = delete;
 
@@ -51,14 +89,113 @@ namespace lox
 
         char* chars() const;
 
-        void concat(const obj_string& other);
+        uint32_t hash() const;
+
+        std::size_t size() const;
 
-        void print() const final;
+        void print(output_sink& out) const;
 
         template <typename T> friend struct std::equal_to;
 
         template <typename T> friend struct std::hash;
     };
+
+    ///
+    /// A string built by concatenation, kept as its two halves until its characters are needed.
+    /// Each half is an obj_string or another obj_rope.
+    ///
+    class obj_rope final : public obj
+    {
+        std::size_t m_length = 0;
+
+        obj* m_left = nullptr;
+
+        obj* m_right = nullptr;
+
+        // The interned characters, once flattened. The halves are released at that point.
+        obj_string* m_flat = nullptr;
+
+        obj_rope(obj* left, obj* right);
+
+        ~obj_rope() = default;
+
+    public:
+
+        static obj_rope* create(allocator& allocator, obj* left, obj* right);
+
+        static void destroy(allocator& allocator, obj_rope* rope);
+
+        obj_rope(const obj_rope& other) = delete;
+
+        obj_rope& operator=(obj_rope other) = delete;
+
+        obj_rope(obj_rope&& other) noexcept = delete;
+
+        obj_rope& operator=(obj_rope&& other) noexcept = delete;
+
+        std::size_t length() const;
+
+        obj_string* flat() const;
+
+        ///
+        /// Records the interned string holding this rope's characters and drops the halves.
+        ///
+        void flatten(obj_string* flat);
+
+        std::size_t size() const;
+
+        ///
+        /// Calls visitor(chars) for every piece of the rope, left to right.
+        /// (Walks an explicit stack, since a chain of appends nests as deep as it is long.)
+        ///
+        template <typename TVisitor>
+        void for_each_piece(TVisitor visitor) const
+        {
+            // Balanced ropes stay well within the inline buffer; only long append chains spill to the heap.
+            stack<const obj*, std::size_t, 32> pending;
+            pending.push(this);
+
+            while (pending.count() > 0)
+            {
+                const auto* piece = pending.pop();
+
+                if (piece->type() == obj_type::STRING)
+                {
+                    const auto* string = static_cast<const obj_string*>(piece);
+
+                    visitor(std::string_view{ string->chars(), string->length() });
+
+                    continue;
+                }
+
+                const auto* rope = static_cast<const obj_rope*>(piece);
+
+                if (rope->m_flat)
+                {
+                    pending.push(rope->m_flat);
+                }
+                else
+                {
+                    pending.push(rope->m_right);
+                    pending.push(rope->m_left);
+                }
+            }
+        }
+
+        void print(output_sink& out) const;
+
+        friend class vm;
+    };
+
+    ///
+    /// Returns the length of a string object, flat or rope.
+    ///
+    inline std::size_t string_length(const obj* string)
+    {
+        return string->type() == obj_type::STRING
+            ? static_cast<const obj_string*>(string)->length()
+            : static_cast<const obj_rope*>(string)->length();
+    }
 }
 
 namespace std
@@ -89,6 +226,11 @@ namespace std
                     static_cast<const lox::obj_string&>(lhs),
                     static_cast<const lox::obj_string&>(rhs)
                 );
+
+            case lox::obj_type::ROPE:
+                // The VM flattens ropes into interned strings before comparing them, so this
+                // only sees a rope that was never compared; it is equal to nothing but itself.
+                return &lhs == &rhs;
             }
 
             return false;
@@ -100,15 +242,21 @@ namespace std
     {
         std::size_t operator()(const lox::obj_string& string) const
         {
-            std::size_t hash = 2166136261u;
-
-            for (std::size_t i = 0; i < string.m_length; ++i)
-            {
-                hash ^= static_cast<std::size_t>(std::bit_cast<uint8_t>(string.m_chars[i]));
-                hash *= 16777619u;
-            }
+            return string.m_hash;
+        }
+    };
+}
 
-            return hash;
+namespace lox
+{
+    ///
+    /// Hashes interned strings by their cached hash rather than by address.
+    ///
+    struct obj_string_hash
+    {
+        std::size_t operator()(const obj_string* string) const
+        {
+            return string->hash();
         }
     };
 }
@@ -0,0 +1,111 @@
+
+#include <algorithm> // upper_bound
+
+#include "optimizer.hpp"
+
+namespace
+{
+    // Bytecode of the region being rewritten, with the line of every byte.
+    struct region
+    {
+        const uint8_t* code;
+        const int* lines;
+        std::size_t count;
+    };
+}
+
+///
+/// Checks whether the instructions starting at an offset are exactly 'pattern',
+/// all emitted for the same line so that the fused instruction keeps an exact line.
+///
+static bool matches(const region& region, std::size_t offset, std::initializer_list<lox::op_code> pattern)
+{
+    const auto line = region.lines[offset];
+
+    for (auto op : pattern)
+    {
+        if (offset >= region.count) return false;
+
+        if (region.code[offset] != op || region.lines[offset] != line) return false;
+
+        offset += lox::instruction_length(op);
+    }
+
+    return true;
+}
+
+void lox::peephole_optimize(chunk& chunk, chunk::idx_t start, arena& scratch)
+{
+    const auto length = chunk.count() - start;
+
+    if (length == 0) return;
+
+    auto* code = scratch.allocate_array<uint8_t>(length);
+    auto* lines = scratch.allocate_array<int>(length);
+
+    const auto& runs = chunk.lines();
+    const auto* first_run = &runs.get(0);
+
+    // The run covering 'start', found by binary search as chunk::line does, so that optimizing
+    // a REPL line does not walk the runs of every line before it.
+    std::size_t run = std::upper_bound(first_run, first_run + runs.count(), start,
+        [](std::size_t offset, const line_start& run) { return offset < run.offset; }) - first_run - 1;
+
+    for (auto offset = start; offset < chunk.count(); ++offset)
+    {
+        while (run + 1 < runs.count() && runs.get(run + 1).offset <= offset) ++run;
+
+        code[offset - start] = chunk.get(offset);
+        lines[offset - start] = runs.get(run).line;
+    }
+
+    const region region{ code, lines, length };
+
+    chunk.truncate(start);
+
+    for (std::size_t offset = 0; offset < region.count;)
+    {
+        const auto op = region.code[offset];
+        const auto line = region.lines[offset];
+        const auto operand = [&region, offset](std::size_t index) { return region.code[offset + index]; };
+
+        switch (op)
+        {
+        case OP_EQUAL:
+            if (!matches(region, offset, { OP_EQUAL, OP_NOT })) break;
+            chunk.write(OP_NOT_EQUAL, line);
+            offset += 2;
+            continue;
+
+        case OP_LESS:
+            if (!matches(region, offset, { OP_LESS, OP_NOT })) break;
+            chunk.write(OP_GREATER_EQUAL, line);
+            offset += 2;
+            continue;
+
+        case OP_GREATER:
+            if (!matches(region, offset, { OP_GREATER, OP_NOT })) break;
+            chunk.write(OP_LESS_EQUAL, line);
+            offset += 2;
+            continue;
+
+        case OP_GET_GLOBAL_SLOT:
+            if (!matches(region, offset, { OP_GET_GLOBAL_SLOT, OP_GET_GLOBAL_SLOT, OP_ADD })) break;
+            chunk.write(OP_ADD_GLOBALS, line);
+            chunk.write(operand(1), line);
+            chunk.write(operand(3), line);
+            offset += 5;
+            continue;
+        }
+
+        // Nothing to fuse; copy the instruction and its operands as they are.
+        const auto length = instruction_length(op);
+
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            chunk.write(region.code[offset + i], line);
+        }
+
+        offset += length;
+    }
+}
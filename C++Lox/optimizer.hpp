@@ -0,0 +1,15 @@
+
+#pragma once
+
+#include "chunk.hpp"
+#include "memory.hpp"
+
+namespace lox
+{
+    ///
+    /// Rewrites the code of a chunk from an offset onwards, fusing common instruction
+    /// sequences into single instructions. The rewritten code must not be jumped into.
+    /// The copy of the original code is taken from 'scratch'.
+    ///
+    void peephole_optimize(chunk& chunk, chunk::idx_t start, arena& scratch);
+}
@@ -0,0 +1,130 @@
+
+#include <cstring> // memcpy
+
+#include "output.hpp"
+
+lox::output_sink::output_sink(std::ostream& stream)
+    : m_stream{ stream }
+{
+}
+
+lox::output_sink::~output_sink()
+{
+    set_background(false);
+    flush();
+}
+
+void lox::output_sink::submit()
+{
+    if (m_buffer && m_size > 0)
+    {
+        if (m_writer.joinable())
+        {
+            // Never waits: every block that exists fits in the ring.
+            m_pending.push({ m_buffer, m_size });
+
+            ++m_submitted;
+
+            m_buffer = nullptr;
+        }
+        else
+        {
+            m_stream.write(m_buffer, m_size);
+        }
+    }
+
+    if (!m_buffer) m_buffer = next_block();
+
+    m_size = 0;
+}
+
+char* lox::output_sink::next_block()
+{
+    char* block = nullptr;
+
+    if (m_free.try_pop(block)) return block;
+
+    if (m_blocks.count() < MAX_BLOCKS)
+    {
+        m_blocks.add(std::make_unique_for_overwrite<char[]>(BLOCK_SIZE));
+
+        return m_blocks.get(m_blocks.count() - 1).get();
+    }
+
+    // Every block is waiting to be written.
+    return m_free.pop();
+}
+
+void lox::output_sink::write_blocks()
+{
+    for (;;)
+    {
+        const auto block = m_pending.pop();
+
+        // An empty block asks the writer to stop.
+        if (!block.data) return;
+
+        m_stream.write(block.data, block.size);
+
+        m_free.push(block.data);
+
+        m_written.fetch_add(1, std::memory_order_release);
+        m_written.notify_one();
+    }
+}
+
+void lox::output_sink::write(std::string_view text)
+{
+    while (!text.empty())
+    {
+        if (m_size == BLOCK_SIZE) submit();
+
+        const auto length = std::min(text.length(), BLOCK_SIZE - m_size);
+
+        std::memcpy(m_buffer + m_size, text.data(), length);
+
+        m_size += length;
+
+        text.remove_prefix(length);
+    }
+}
+
+void lox::output_sink::put(char c)
+{
+    if (m_size == BLOCK_SIZE) submit();
+
+    m_buffer[m_size++] = c;
+}
+
+void lox::output_sink::flush()
+{
+    if (m_buffer && m_size > 0) submit();
+
+    if (m_writer.joinable())
+    {
+        for (auto written = m_written.load(std::memory_order_acquire); written != m_submitted; written = m_written.load(std::memory_order_acquire))
+        {
+            m_written.wait(written, std::memory_order_acquire);
+        }
+    }
+
+    m_stream.flush();
+}
+
+void lox::output_sink::set_background(bool background)
+{
+    if (background == m_writer.joinable()) return;
+
+    flush();
+
+    if (background)
+    {
+        m_writer = std::thread{ &output_sink::write_blocks, this };
+    }
+    else
+    {
+        m_pending.push({});
+
+        m_writer.join();
+    }
+}
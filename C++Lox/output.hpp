@@ -0,0 +1,85 @@
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "array.hpp"
+#include "common.hpp"
+#include "ring.hpp"
+
+namespace lox
+{
+    ///
+    /// Gathers printed text into large blocks and hands the stream one whole block at a time.
+    /// In background mode a writer thread takes the full blocks, so printing never waits on I/O.
+    ///
+    class output_sink
+    {
+    public:
+
+        static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+    private:
+
+        // Blocks that may exist at once. Only once all of them are waiting to be written
+        // does the interpreter have to wait for the writer thread.
+        static constexpr std::size_t MAX_BLOCKS = 8;
+
+        struct block
+        {
+            char*       data = nullptr;
+            std::size_t size = 0;
+        };
+
+        std::ostream& m_stream;
+
+        array<std::unique_ptr<char[]>> m_blocks;
+
+        // Block being filled. Until there is one, the sink counts as full, so the first write fetches it.
+        char*       m_buffer = nullptr;
+        std::size_t m_size   = BLOCK_SIZE;
+
+        // Background mode: full blocks go to the writer thread through m_pending and come back through m_free.
+        std::thread                  m_writer;
+        spsc_ring<block, MAX_BLOCKS> m_pending;
+        spsc_ring<char*, MAX_BLOCKS> m_free;
+
+        std::size_t              m_submitted = 0;
+        std::atomic<std::size_t> m_written   = 0;
+
+        ///
+        /// Passes the current block on, to the stream or the writer thread, and starts another.
+        ///
+        void submit();
+
+        char* next_block();
+
+        void write_blocks();
+
+    public:
+
+        output_sink(std::ostream& stream);
+
+        output_sink(const output_sink&) = delete;
+
+        output_sink& operator=(const output_sink&) = delete;
+
+        ~output_sink();
+
+        void write(std::string_view text);
+
+        void put(char c);
+
+        ///
+        /// Writes out everything printed so far, waiting for the writer thread if there is one.
+        ///
+        void flush();
+
+        ///
+        /// Starts or stops the writer thread, after flushing.
+        ///
+        void set_background(bool background);
+    };
+}
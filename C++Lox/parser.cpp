@@ -1,8 +1,66 @@
 
 #include "parser.hpp"
 
+#ifdef TOKEN_BUFFER
+
+lox::parser::parser(const std::string_view source)
+    : m_tokens{ source }
+    , m_current{ 0 }
+    , m_previous{ 0 }
+    , m_next{ 0 }
+    , m_current_line{ 1 }
+    , m_previous_line{ 1 }
+    , m_newlines{ 0 }
+    , m_had_error{ false }
+    , m_panic_mode{ false }
+{
+}
+
+lox::token lox::parser::get(std::size_t index, int line) const
+{
+    return { m_tokens.type(index), m_tokens.text(index), line };
+}
+
+lox::token lox::parser::current() const
+{
+    return get(m_current, m_current_line);
+}
+
+lox::token lox::parser::previous() const
+{
+    return get(m_previous, m_previous_line);
+}
+
+void lox::parser::advance()
+{
+    m_previous = m_current;
+    m_previous_line = m_current_line;
+
+    while (true)
+    {
+        m_current = m_next;
+        m_current_line = m_tokens.line(m_current, m_newlines);
+
+        // The buffer ends with END_OF_FILE, which keeps being the current token from then on.
+        if (m_next + 1 < m_tokens.count()) ++m_next;
+
+        if (m_tokens.type(m_current) != token_type::ERROR) break;
+
+        error_at_current(m_tokens.text(m_current));
+    }
+}
+
+bool lox::parser::check(const token_type type) const
+{
+    return m_tokens.type(m_current) == type;
+}
+
+#else
+
 lox::parser::parser(const std::string_view source)
     : m_scanner{ source }
+    , m_current{}
+    , m_previous{}
     , m_had_error{ false }
     , m_panic_mode{ false }
 {
@@ -24,7 +82,7 @@ void lox::parser::advance()
 
     while (true)
     {
-        m_current = m_scanner.scan_token();
+        m_current = m_scanner.next_token();
 
         if (m_current.type != token_type::ERROR) break;
 
@@ -32,9 +90,16 @@ void lox::parser::advance()
     }
 }
 
+bool lox::parser::check(const token_type type) const
+{
+    return m_current.type == type;
+}
+
+#endif
+
 void lox::parser::consume(const token_type type, const std::string_view message)
 {
-    if (m_current.type == type)
+    if (check(type))
     {
         advance();
 
@@ -44,11 +109,6 @@ void lox::parser::consume(const token_type type, const std::string_view message)
     error_at_current(message);
 }
 
-bool lox::parser::check(const token_type type) const
-{
-    return m_current.type == type;
-}
-
 bool lox::parser::match(const token_type type)
 {
     if (!check(type)) return false;
@@ -60,12 +120,12 @@ bool lox::parser::match(const token_type type)
 
 void lox::parser::error_at_current(const std::string_view message)
 {
-    error_at(m_current, message);
+    error_at(current(), message);
 }
 
 void lox::parser::error(const std::string_view message)
 {
-    error_at(m_current, message);
+    error_at(current(), message);
 }
 
 void lox::parser::error_at(const token& token, const std::string_view message)
@@ -105,11 +165,11 @@ void lox::parser::synchronize_if_panicking()
 
     m_panic_mode = false;
 
-    while (m_current.type != token_type::END_OF_FILE)
+    while (!check(token_type::END_OF_FILE))
     {
-        if (m_previous.type == token_type::SEMICOLON) return;
+        if (previous().type == token_type::SEMICOLON) return;
 
-        switch (m_current.type)
+        switch (current().type)
         {
         case token_type::CLASS:
         case token_type::FUN:
@@ -7,14 +7,36 @@ namespace lox
 {
     class parser
     {
+#ifdef TOKEN_BUFFER
+        token_buffer m_tokens;
+
+        // Indices of the current and previous tokens, whose lines are kept at hand
+        // since every byte the compiler emits asks for one.
+        std::size_t m_current;
+        std::size_t m_previous;
+
+        // Index of the token after the current one.
+        std::size_t m_next;
+
+        int m_current_line;
+        int m_previous_line;
+
+        // Amount of newlines before the current token.
+        std::size_t m_newlines;
+#else
         scanner m_scanner;
 
         token m_current;
         token m_previous;
+#endif
 
         bool m_had_error;
         bool m_panic_mode;
 
+#ifdef TOKEN_BUFFER
+        token get(std::size_t index, int line) const;
+#endif
+
     public:
 
         parser(const std::string_view source);
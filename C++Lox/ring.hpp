@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+
+#include "common.hpp"
+
+namespace lox
+{
+    ///
+    /// Bounded queue between exactly one producer thread and one consumer thread, without locks.
+    /// Each side only writes its own index, so acquire and release ordering is all they need.
+    ///
+    template <typename TElement, std::size_t Capacity>
+    class spsc_ring
+    {
+        static_assert(std::has_single_bit(Capacity), "The capacity must be a power of two.");
+
+    public:
+
+        using elem_t = TElement;
+
+    private:
+
+        std::array<elem_t, Capacity> m_elements{};
+
+        // Kept on separate cache lines, since each is written by a different thread.
+
+        // Count of elements ever popped. Written by the consumer only.
+        alignas(64) std::atomic<std::size_t> m_head = 0;
+
+        // Count of elements ever pushed. Written by the producer only.
+        alignas(64) std::atomic<std::size_t> m_tail = 0;
+
+    public:
+
+        ///
+        /// Adds an element unless the ring is full. Producer only.
+        ///
+        bool try_push(elem_t element)
+        {
+            const auto tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail - m_head.load(std::memory_order_acquire) == Capacity) return false;
+
+            m_elements[tail & (Capacity - 1)] = std::move(element);
+
+            m_tail.store(tail + 1, std::memory_order_release);
+            m_tail.notify_one();
+
+            return true;
+        }
+
+        ///
+        /// Adds an element, sleeping while the ring is full. Producer only.
+        ///
+        void push(elem_t element)
+        {
+            for (;;)
+            {
+                const auto head = m_head.load(std::memory_order_acquire);
+
+                if (m_tail.load(std::memory_order_relaxed) - head < Capacity) break;
+
+                m_head.wait(head, std::memory_order_acquire);
+            }
+
+            try_push(std::move(element));
+        }
+
+        ///
+        /// Removes the oldest element into 'element' unless the ring is empty. Consumer only.
+        ///
+        bool try_pop(elem_t& element)
+        {
+            const auto head = m_head.load(std::memory_order_relaxed);
+
+            if (head == m_tail.load(std::memory_order_acquire)) return false;
+
+            element = std::move(m_elements[head & (Capacity - 1)]);
+
+            m_head.store(head + 1, std::memory_order_release);
+            m_head.notify_one();
+
+            return true;
+        }
+
+        ///
+        /// Removes and returns the oldest element, sleeping while the ring is empty. Consumer only.
+        ///
+        elem_t pop()
+        {
+            for (;;)
+            {
+                const auto tail = m_tail.load(std::memory_order_acquire);
+
+                if (tail != m_head.load(std::memory_order_relaxed)) break;
+
+                m_tail.wait(tail, std::memory_order_acquire);
+            }
+
+            elem_t element{};
+
+            try_pop(element);
+
+            return element;
+        }
+    };
+}
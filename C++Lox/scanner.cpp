@@ -1,29 +1,146 @@
 
+#include <algorithm> // count, upper_bound
+#include <array>
+#include <bit>
+#include <cstring> // memchr, memcpy
+#include <limits>
+
 #include "scanner.hpp"
 
+namespace
+{
+    struct keyword
+    {
+        std::string_view text;
+        lox::token_type  type;
+    };
+
+    // Every keyword, in token_type order from AND to WHILE.
+    constexpr keyword KEYWORDS[] =
+    {
+        { "and",    lox::token_type::AND },
+        { "class",  lox::token_type::CLASS },
+        { "else",   lox::token_type::ELSE },
+        { "false",  lox::token_type::FALSE },
+        { "for",    lox::token_type::FOR },
+        { "fun",    lox::token_type::FUN },
+        { "if",     lox::token_type::IF },
+        { "nil",    lox::token_type::NIL },
+        { "or",     lox::token_type::OR },
+        { "print",  lox::token_type::PRINT },
+        { "return", lox::token_type::RETURN },
+        { "super",  lox::token_type::SUPER },
+        { "this",   lox::token_type::THIS },
+        { "true",   lox::token_type::TRUE },
+        { "var",    lox::token_type::VAR },
+        { "while",  lox::token_type::WHILE },
+    };
+
+    static_assert(std::size(KEYWORDS) == static_cast<std::size_t>(lox::token_type::WHILE) - static_cast<std::size_t>(lox::token_type::AND) + 1,
+        "Every keyword token needs an entry in KEYWORDS.");
+
+    static_assert([]
+    {
+        for (std::size_t i = 0; i < std::size(KEYWORDS); ++i)
+        {
+            if (static_cast<std::size_t>(KEYWORDS[i].type) != static_cast<std::size_t>(lox::token_type::AND) + i) return false;
+        }
+
+        return true;
+    }(), "KEYWORDS must be listed in token_type order.");
+
+    constexpr std::size_t KEYWORD_SLOTS = 32;
+}
+
+///
+/// Hashes an identifier by its length and its first and last characters.
+///
+static constexpr std::size_t keyword_slot(std::string_view text, std::size_t multiplier)
+{
+    return (static_cast<uint8_t>(text.front()) + static_cast<uint8_t>(text.back()) * multiplier + text.length()) & (KEYWORD_SLOTS - 1);
+}
+
+// Smallest multiplier for which no two keywords share a slot, found at compile time.
+static constexpr std::size_t KEYWORD_MULTIPLIER = []
+{
+    for (std::size_t multiplier = 1; multiplier < KEYWORD_SLOTS; ++multiplier)
+    {
+        bool taken[KEYWORD_SLOTS] = {};
+        bool perfect = true;
+
+        for (const auto& keyword : KEYWORDS)
+        {
+            auto& slot = taken[keyword_slot(keyword.text, multiplier)];
+
+            if (slot) perfect = false;
+
+            slot = true;
+        }
+
+        if (perfect) return multiplier;
+    }
+
+    return std::size_t{ 0 };
+}();
+
+static_assert(KEYWORD_MULTIPLIER != 0, "The keywords have no perfect hash into KEYWORD_SLOTS slots.");
+
+// Each keyword in its slot; the other slots hold an empty text, which no identifier matches.
+static constexpr auto KEYWORD_TABLE = []
+{
+    std::array<keyword, KEYWORD_SLOTS> table{};
+
+    table.fill({ {}, lox::token_type::IDENTIFIER });
+
+    for (const auto& keyword : KEYWORDS)
+    {
+        table[keyword_slot(keyword.text, KEYWORD_MULTIPLIER)] = keyword;
+    }
+
+    return table;
+}();
+
+///
+/// Returns the offset of the first character at or after 'offset' that is not a space. Indentation
+/// comes in long runs of spaces, so they are compared eight at a time.
+///
+static std::size_t skip_spaces(std::string_view source, std::size_t offset)
+{
+    constexpr uint64_t SPACES = 0x2020202020202020;
+
+    for (; offset + sizeof(uint64_t) <= source.length(); offset += sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        std::memcpy(&word, source.data() + offset, sizeof(word));
+
+        // Zero bytes are spaces; the first non-zero one, in memory order, ends the run.
+        if (const auto others = word ^ SPACES; others != 0)
+        {
+            return offset + (std::endian::native == std::endian::little ? std::countr_zero(others) : std::countl_zero(others)) / 8;
+        }
+    }
+
+    while (offset < source.length() && source[offset] == ' ') ++offset;
+
+    return offset;
+}
+
 bool lox::scanner::is_at_end()
 {
     return m_current == m_source.length();
 }
 
-lox::token lox::scanner::make_token(const lox::token_type type)
+lox::token_type lox::scanner::make_token(const lox::token_type type)
 {
-    return
-    {
-        type,
-        m_source.substr(m_start, m_current - m_start),
-        m_line
-    };
+    return type;
 }
 
-lox::token lox::scanner::error_token(const std::string_view message)
+lox::token_type lox::scanner::error_token(const std::string_view message)
 {
-    return
-    {
-        token_type::ERROR,
-        message,
-        m_line
-    };
+    m_error = message;
+
+    return token_type::ERROR;
 }
 
 char lox::scanner::advance()
@@ -67,6 +184,8 @@ void lox::scanner::skip_whitespace()
         switch (c)
         {
         case ' ':
+            m_current = skip_spaces(m_source, m_current);
+            break;
         case '\r':
         case '\t':
             advance();
@@ -79,7 +198,9 @@ void lox::scanner::skip_whitespace()
             if (peek_next() == '/')
             {
                 // A comment goes until the end of the line.
-                while (peek() != '\n' && !is_at_end()) advance();
+                const auto* newline = std::memchr(m_source.data() + m_current, '\n', m_source.length() - m_current);
+
+                m_current = newline ? static_cast<const char*>(newline) - m_source.data() : m_source.length();
             }
             else
             {
@@ -92,14 +213,13 @@ void lox::scanner::skip_whitespace()
     }
 }
 
-lox::token lox::scanner::make_string()
+lox::token_type lox::scanner::make_string()
 {
-    while (peek() != '"' && !is_at_end())
-    {
-        if (peek() == '\n') m_line++;
+    const auto* quote = std::memchr(m_source.data() + m_current, '"', m_source.length() - m_current);
 
-        advance();
-    }
+    m_current = quote ? static_cast<const char*>(quote) - m_source.data() : m_source.length();
+
+    m_line += static_cast<int>(std::count(m_source.data() + m_start, m_source.data() + m_current, '\n'));
 
     if (is_at_end()) return error_token("Unterminated string.");
 
@@ -114,7 +234,7 @@ bool lox::scanner::is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
-lox::token lox::scanner::number()
+lox::token_type lox::scanner::number()
 {
     while (is_digit(peek())) advance();
 
@@ -137,59 +257,16 @@ bool lox::scanner::is_alpha(char c)
         c == '_';
 }
 
-lox::token_type lox::scanner::check_keyword(const std::size_t start, const std::string_view rest, const token_type type)
-{
-    if (m_current - m_start == start + rest.length()
-        && rest.compare(m_source.substr(m_start + start, rest.length())) == 0)
-    {
-        return type;
-    }
-
-    return token_type::IDENTIFIER;
-}
-
 lox::token_type lox::scanner::identifier_type()
 {
-    switch (m_source[m_start])
-    {
-    case 'a': return check_keyword(1, "nd", token_type::AND);
-    case 'c': return check_keyword(1, "lass", token_type::CLASS);
-    case 'e': return check_keyword(1, "lse", token_type::ELSE);
-    case 'f':
-        if (m_current - m_start > 1)
-        {
-            switch (m_source[m_start + 1])
-            {
-            case 'a': return check_keyword(2, "lse", token_type::FALSE);
-            case 'o': return check_keyword(2, "r", token_type::FOR);
-            case 'u': return check_keyword(2, "n", token_type::FUN);
-            }
-        }
-        break;
-    case 'i': return check_keyword(1, "f", token_type::IF);
-    case 'n': return check_keyword(1, "il", token_type::NIL);
-    case 'o': return check_keyword(1, "r", token_type::OR);
-    case 'p': return check_keyword(1, "rint", token_type::PRINT);
-    case 'r': return check_keyword(1, "eturn", token_type::RETURN);
-    case 's': return check_keyword(1, "uper", token_type::SUPER);
-    case 't':
-        if (m_current - m_start > 1)
-        {
-            switch (m_source[m_start + 1])
-            {
-            case 'h': return check_keyword(2, "is", token_type::THIS);
-            case 'r': return check_keyword(2, "ue", token_type::TRUE);
-            }
-        }
-        break;
-    case 'v': return check_keyword(1, "ar", token_type::VAR);
-    case 'w': return check_keyword(1, "hile", token_type::WHILE);
-    }
+    const auto text = m_source.substr(m_start, m_current - m_start);
+
+    const auto& keyword = KEYWORD_TABLE[keyword_slot(text, KEYWORD_MULTIPLIER)];
 
-    return token_type::IDENTIFIER;
+    return keyword.text == text ? keyword.type : token_type::IDENTIFIER;
 }
 
-lox::token lox::scanner::identifier()
+lox::token_type lox::scanner::identifier()
 {
     while (is_alpha(peek()) || is_digit(peek())) advance();
 
@@ -202,7 +279,7 @@ lox::scanner::scanner(const std::string_view source) : m_source{ source }
     m_line = 1;
 }
 
-lox::token lox::scanner::scan_token()
+lox::token_type lox::scanner::scan_token()
 {
     skip_whitespace();
 
@@ -238,3 +315,117 @@ lox::token lox::scanner::scan_token()
 
     return error_token("Unexpected character.");
 }
+
+lox::token lox::scanner::next_token()
+{
+    const auto type = scan_token();
+
+    return
+    {
+        type,
+        type == token_type::ERROR ? m_error : m_source.substr(m_start, m_current - m_start),
+        m_line
+    };
+}
+
+std::size_t lox::scanner::start() const
+{
+    return m_start;
+}
+
+std::size_t lox::scanner::length() const
+{
+    return m_current - m_start;
+}
+
+std::string_view lox::scanner::error_message() const
+{
+    return m_error;
+}
+
+lox::token_buffer::token_buffer(const std::string_view source) : m_source{ source }
+{
+    // Offsets and lengths are 32 bits wide.
+    if (source.length() > std::numeric_limits<uint32_t>::max())
+    {
+        m_errors.add("Source is too large.");
+
+        add(token_type::ERROR, 0, 0);
+        add(token_type::END_OF_FILE, 0, 0);
+
+        return;
+    }
+
+    for (const auto* newline = source.data(), *end = source.data() + source.length();
+        (newline = static_cast<const char*>(std::memchr(newline, '\n', end - newline))) != nullptr;
+        ++newline)
+    {
+        m_newlines.add(static_cast<uint32_t>(newline - source.data()));
+    }
+
+    // A rough guess of one token per six characters saves most of the regrowth.
+    m_types.reserve(source.length() / 6 + 1);
+    m_offsets.reserve(source.length() / 6 + 1);
+    m_lengths.reserve(source.length() / 6 + 1);
+
+    scanner scanner{ source };
+
+    for (;;)
+    {
+        const auto type = scanner.scan_token();
+
+        if (type == token_type::ERROR)
+        {
+            add(type, scanner.start() + scanner.length(), m_errors.add(scanner.error_message()));
+
+            continue;
+        }
+
+        add(type, scanner.start(), scanner.length());
+
+        if (type == token_type::END_OF_FILE) break;
+    }
+}
+
+void lox::token_buffer::add(token_type type, std::size_t offset, std::size_t length)
+{
+    m_types.add(type);
+    m_offsets.add(static_cast<uint32_t>(offset));
+    m_lengths.add(static_cast<uint32_t>(length));
+}
+
+std::size_t lox::token_buffer::count() const
+{
+    return m_types.count();
+}
+
+lox::token_type lox::token_buffer::type(std::size_t index) const
+{
+    return m_types.get(index);
+}
+
+int lox::token_buffer::line(std::size_t index) const
+{
+    if (m_newlines.count() == 0) return 1;
+
+    const auto* newlines = &m_newlines.get(0);
+
+    // One more than the amount of newlines before the token.
+    return static_cast<int>(std::upper_bound(newlines, newlines + m_newlines.count(), m_offsets.get(index)) - newlines) + 1;
+}
+
+std::string_view lox::token_buffer::text(std::size_t index) const
+{
+    if (m_types.get(index) == token_type::ERROR) return m_errors.get(m_lengths.get(index));
+
+    return m_source.substr(m_offsets.get(index), m_lengths.get(index));
+}
+
+int lox::token_buffer::line(std::size_t index, std::size_t& newlines) const
+{
+    const auto offset = m_offsets.get(index);
+
+    while (newlines < m_newlines.count() && m_newlines.get(newlines) < offset) ++newlines;
+
+    return static_cast<int>(newlines) + 1;
+}
@@ -1,11 +1,12 @@
 
 #pragma once
 
+#include "array.hpp"
 #include "common.hpp"
 
 namespace lox
 {
-    enum class token_type : int
+    enum class token_type : uint8_t
     {
         // Single-character tokens.
         LEFT_PAREN, RIGHT_PAREN,
@@ -35,6 +36,9 @@ namespace lox
         int              line;
     };
 
+    ///
+    /// Splits a source into tokens, one at a time, as the parser asks for them.
+    ///
     class scanner
     {
         const std::string_view m_source;
@@ -45,11 +49,13 @@ namespace lox
 
         int m_line;
 
+        std::string_view m_error;
+
         bool is_at_end();
 
-        token make_token(const token_type type);
+        token_type make_token(const token_type type);
 
-        token error_token(const std::string_view message);
+        token_type error_token(const std::string_view message);
 
         char advance();
 
@@ -61,24 +67,81 @@ namespace lox
 
         void skip_whitespace();
 
-        token make_string();
+        token_type make_string();
 
         bool is_digit(char c);
 
-        token number();
+        token_type number();
 
         bool is_alpha(char c);
 
-        token_type check_keyword(const std::size_t start, const std::string_view rest, const token_type type);
-
         token_type identifier_type();
 
-        token identifier();
+        token_type identifier();
 
     public:
 
         scanner(const std::string_view source);
 
-        token scan_token();
+        ///
+        /// Scans the next token and returns its type. Its text spans [start(), start() + length()),
+        /// except for an ERROR token, whose text is error_message() and which ends at start() + length().
+        ///
+        token_type scan_token();
+
+        ///
+        /// Scans the next token and returns it whole, with its text and the line it ends on.
+        ///
+        token next_token();
+
+        std::size_t start() const;
+
+        std::size_t length() const;
+
+        std::string_view error_message() const;
+    };
+
+    ///
+    /// Every token of a source, scanned up front in a single pass and kept as parallel arrays.
+    /// Lines are not stored: they are looked up on demand in an index of the source's newlines.
+    /// (The parser only reads from one when built with TOKEN_BUFFER.)
+    ///
+    class token_buffer
+    {
+        std::string_view m_source;
+
+        array<token_type> m_types;
+
+        // Where each token starts in the source. An ERROR token is placed where scanning it stopped.
+        array<uint32_t> m_offsets;
+
+        // Length of each token, or, for an ERROR token, the index of its message in m_errors.
+        array<uint32_t> m_lengths;
+
+        // Offset of every newline in the source, in ascending order.
+        array<uint32_t> m_newlines;
+
+        array<std::string_view> m_errors;
+
+        void add(token_type type, std::size_t offset, std::size_t length);
+
+    public:
+
+        token_buffer(const std::string_view source);
+
+        std::size_t count() const;
+
+        token_type type(std::size_t index) const;
+
+        std::string_view text(std::size_t index) const;
+
+        int line(std::size_t index) const;
+
+        ///
+        /// Returns the line of a token, counting forward from 'newlines', the amount of newlines
+        /// before some earlier token, which is updated for this one. Reading the tokens in order
+        /// this way costs constant time per token instead of a search.
+        ///
+        int line(std::size_t index, std::size_t& newlines) const;
     };
 }
@@ -0,0 +1,142 @@
+
+#include "source.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap and munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close
+#endif // _WIN32
+
+// Amount read at a time when the text cannot be mapped.
+static constexpr std::size_t READ_CHUNK_SIZE = 64 * 1024;
+
+lox::source_file::source_file(const std::string& path)
+{
+    if (path == "-")
+    {
+        m_is_open = read(stdin);
+
+        return;
+    }
+
+    if (map(path))
+    {
+        m_is_open = true;
+
+        return;
+    }
+
+    auto* stream = std::fopen(path.c_str(), "rb");
+
+    if (!stream) return;
+
+    m_is_open = read(stream);
+
+    std::fclose(stream);
+}
+
+lox::source_file::~source_file()
+{
+    if (!m_is_mapped) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<char*>(m_data), m_length);
+#endif // _WIN32
+}
+
+///
+/// Maps a regular, non-empty file. (Empty files cannot be mapped, and pipes or devices
+/// have no size to map, so those are left for read.)
+///
+bool lox::source_file::map(const std::string& path)
+{
+#ifdef _WIN32
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size{};
+
+    const void* view = nullptr;
+
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        if (auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+        {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+            // The view keeps the mapping alive.
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+
+    if (!view) return false;
+
+    m_length = static_cast<std::size_t>(size.QuadPart);
+#else
+    const auto file = ::open(path.c_str(), O_RDONLY);
+
+    if (file < 0) return false;
+
+    struct stat info{};
+
+    void* view = MAP_FAILED;
+
+    if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        view = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    }
+
+    // The mapping outlives the descriptor.
+    ::close(file);
+
+    if (view == MAP_FAILED) return false;
+
+    m_length = static_cast<std::size_t>(info.st_size);
+#endif // _WIN32
+
+    m_data = static_cast<const char*>(view);
+    m_is_mapped = true;
+
+    return true;
+}
+
+bool lox::source_file::read(std::FILE* stream)
+{
+    for (;;)
+    {
+        const auto length = m_buffer.length();
+
+        m_buffer.resize(length + READ_CHUNK_SIZE);
+
+        const auto count = std::fread(m_buffer.data() + length, 1, READ_CHUNK_SIZE, stream);
+
+        m_buffer.resize(length + count);
+
+        if (count < READ_CHUNK_SIZE) break;
+    }
+
+    m_data = m_buffer.data();
+    m_length = m_buffer.length();
+
+    return !std::ferror(stream);
+}
+
+bool lox::source_file::is_open() const
+{
+    return m_is_open;
+}
+
+std::string_view lox::source_file::text() const
+{
+    return { m_data, m_length };
+}
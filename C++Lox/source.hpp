@@ -0,0 +1,48 @@
+
+#pragma once
+
+#include <cstdio>
+
+#include "common.hpp"
+
+namespace lox
+{
+    ///
+    /// The text of a script. Regular files are mapped read-only, so the text is never copied;
+    /// anything that cannot be mapped, such as a pipe or standard input, is read in large chunks.
+    ///
+    class source_file
+    {
+        const char* m_data = nullptr;
+
+        std::size_t m_length = 0;
+
+        bool m_is_open = false;
+
+        bool m_is_mapped = false;
+
+        // Holds the text when it could not be mapped.
+        std::string m_buffer;
+
+        bool map(const std::string& path);
+
+        bool read(std::FILE* stream);
+
+    public:
+
+        ///
+        /// Opens the file at 'path', or standard input if the path is "-".
+        ///
+        source_file(const std::string& path);
+
+        source_file(const source_file&) = delete;
+
+        source_file& operator=(const source_file&) = delete;
+
+        ~source_file();
+
+        bool is_open() const;
+
+        std::string_view text() const;
+    };
+}
@@ -3,11 +3,12 @@
 
 #include "array.hpp"
 #include "common.hpp"
+#include "memory.hpp"
 
 namespace lox
 {
-    template <typename TElement, std::unsigned_integral TCapacity = std::size_t>
-    class stack : public array<TElement, std::size_t, TCapacity>
+    template <typename TElement, std::unsigned_integral TCapacity = std::size_t, std::size_t InlineCapacity = 0>
+    class stack : public array<TElement, std::size_t, TCapacity, InlineCapacity>
     {
     public:
 
@@ -27,11 +28,19 @@ namespace lox
         ///
         elem_t pop()
         {
-            elem_t aux{};
+            auto element = std::move(this->m_elements[this->m_count - 1]);
 
-            std::swap(aux, this->m_elements[--this->m_count]);
+            this->truncate(this->m_count - 1);
 
-            return aux;
+            return element;
+        }
+
+        ///
+        /// Removes 'count' elements from the top of the stack.
+        ///
+        void pop(idx_t count)
+        {
+            this->truncate(this->m_count - count);
         }
 
         ///
@@ -50,4 +59,141 @@ namespace lox
             return this->m_elements[this->m_count - depth - 1];
         }
     };
+
+    static_assert(collection<stack<uint8_t>>);
+
+    ///
+    /// Stack with a capacity fixed at creation and a raw pointer to its top. Operations check nothing:
+    /// whoever pushes must have made sure beforehand that the stack cannot get deeper than its capacity.
+    ///
+    template <typename TElement>
+    class fixed_stack
+    {
+    public:
+
+        using elem_t = TElement;
+        using idx_t  = std::size_t;
+        using cap_t  = std::size_t;
+
+    private:
+
+        cap_t m_capacity;
+
+        unique_array<elem_t> m_elements;
+
+        // One past the topmost element.
+        elem_t* m_top;
+
+    public:
+
+        ///
+        /// Creates an empty stack with room for 'capacity' elements.
+        ///
+        fixed_stack(cap_t capacity)
+            : m_capacity{ capacity }
+            , m_elements{ allocate_array<elem_t>(capacity) }
+            , m_top{ m_elements.get() }
+        {
+        }
+
+        fixed_stack(const fixed_stack& other) = delete;
+
+        fixed_stack& operator=(const fixed_stack& other) = delete;
+
+        ///
+        /// Returns the amount of elements on the stack.
+        ///
+        cap_t count() const
+        {
+            return static_cast<cap_t>(m_top - m_elements.get());
+        }
+
+        ///
+        /// Returns the maximum amount of elements the stack can hold.
+        ///
+        cap_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        ///
+        /// Retrieves a reference to an element at an index, starting from the bottom.
+        ///
+        elem_t& get(idx_t index)
+        {
+            return m_elements[index];
+        }
+
+        ///
+        /// Retrieves a const reference to an element at an index, starting from the bottom.
+        ///
+        const elem_t& get(idx_t index) const
+        {
+            return m_elements[index];
+        }
+
+        ///
+        /// Returns a pointer one past the topmost element, so a hot loop can keep the top in a local.
+        ///
+        elem_t* top()
+        {
+            return m_top;
+        }
+
+        ///
+        /// Moves the top to a pointer previously taken from top(), after pushing and popping through it.
+        ///
+        void set_top(elem_t* top)
+        {
+            m_top = top;
+        }
+
+        ///
+        /// Adds an element on top of the stack.
+        ///
+        void push(elem_t element)
+        {
+            *m_top++ = element;
+        }
+
+        ///
+        /// Removes an element from the top of the stack and returns it.
+        ///
+        elem_t pop()
+        {
+            return *--m_top;
+        }
+
+        ///
+        /// Removes 'count' elements from the top of the stack.
+        ///
+        void pop(idx_t count)
+        {
+            m_top -= count;
+        }
+
+        ///
+        /// Returns a reference to an element at a depth starting from the top.
+        ///
+        elem_t& peek(idx_t depth = 0)
+        {
+            return *(m_top - depth - 1);
+        }
+
+        ///
+        /// Returns a const reference to an element at a depth starting from the top.
+        ///
+        const elem_t& peek(idx_t depth = 0) const
+        {
+            return *(m_top - depth - 1);
+        }
+
+        ///
+        /// Empties the stack.
+        ///
+        void reset()
+        {
+            m_top = m_elements.get();
+        }
+    };
 }
@@ -0,0 +1,353 @@
+
+#pragma once
+
+#include <bit>
+
+#include "common.hpp"
+#include "memory.hpp"
+
+namespace lox
+{
+    ///
+    /// FNV-1a hash of a sequence of characters.
+    ///
+    constexpr uint32_t hash_string(std::string_view text)
+    {
+        uint32_t hash = 2166136261u;
+
+        for (auto c : text)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    struct string_hash
+    {
+        std::size_t operator()(std::string_view text) const
+        {
+            return hash_string(text);
+        }
+    };
+
+    ///
+    /// Open-addressing hash table with linear probing and tombstone deletion.
+    /// Every entry keeps its hash, so growing never rehashes a key.
+    ///
+    template
+    <
+        typename TKey,
+        typename TValue,
+        typename THash  = std::hash<TKey>,
+        typename TEqual = std::equal_to<TKey>
+    >
+    class table
+    {
+    public:
+
+        using key_t   = TKey;
+        using value_t = TValue;
+
+    private:
+
+        // Rehash once full entries and tombstones take up this share of the slots.
+        static constexpr double MAX_LOAD = 0.75;
+
+        enum class slot_state : uint8_t
+        {
+            EMPTY,
+            FULL,
+            TOMBSTONE
+        };
+
+        struct entry
+        {
+            key_t       key   = {};
+            value_t     value = {};
+            std::size_t hash  = 0;
+            slot_state  state = slot_state::EMPTY;
+        };
+
+        std::size_t m_count = 0;
+
+        // Full entries plus tombstones, which both lengthen probe sequences.
+        std::size_t m_used = 0;
+
+        std::size_t m_capacity = 0;
+
+        unique_array<entry> m_entries = nullptr;
+
+        ///
+        /// Maps a hash to its home slot by taking the top bits of its product with 2^64/phi
+        /// (Fibonacci hashing), which spreads identity hashes such as pointers or NaN-boxed bits.
+        ///
+        std::size_t home(std::size_t hash) const
+        {
+            return static_cast<std::size_t>((static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ull) >> (64 - std::countr_zero(m_capacity)));
+        }
+
+        ///
+        /// Returns the entry whose key matches, or else the slot a new key with this hash
+        /// should take: the first tombstone on its probe sequence, or the empty slot ending it.
+        ///
+        template <typename TMatch>
+        entry* probe(std::size_t hash, TMatch match) const
+        {
+            entry* tombstone = nullptr;
+
+            for (auto index = home(hash);; index = (index + 1) & (m_capacity - 1))
+            {
+                auto& slot = m_entries[index];
+
+                switch (slot.state)
+                {
+                case slot_state::EMPTY:
+                    return tombstone ? tombstone : &slot;
+
+                case slot_state::TOMBSTONE:
+                    if (!tombstone) tombstone = &slot;
+                    break;
+
+                case slot_state::FULL:
+                    if (slot.hash == hash && match(slot.key)) return &slot;
+                    break;
+                }
+            }
+        }
+
+        entry* probe(const key_t& key, std::size_t hash) const
+        {
+            return probe(hash, [&key](const key_t& other) { return TEqual{}(key, other); });
+        }
+
+        ///
+        /// Rehashes every entry into a fresh array, dropping the tombstones. The array only doubles when
+        /// the live entries fill half of the allowed load; otherwise the slots were mostly tombstones and
+        /// the table keeps its size, so erasing and inserting in a loop does not grow it forever.
+        ///
+        void rehash()
+        {
+            auto old_entries  = std::move(m_entries);
+            auto old_capacity = m_capacity;
+
+            if (old_capacity < 8)
+            {
+                m_capacity = 8;
+            }
+            else if (m_count + 1 > old_capacity * MAX_LOAD / 2)
+            {
+                m_capacity = old_capacity * 2;
+            }
+            m_entries  = allocate_array<entry>(m_capacity);
+            m_used     = m_count;
+
+            for (std::size_t i = 0; i < old_capacity; ++i)
+            {
+                auto& old_entry = old_entries[i];
+
+                if (old_entry.state != slot_state::FULL) continue;
+
+                // Keys are unique and there are no tombstones yet, so the first empty slot will do.
+                auto index = home(old_entry.hash);
+
+                while (m_entries[index].state != slot_state::EMPTY) index = (index + 1) & (m_capacity - 1);
+
+                m_entries[index] = std::move(old_entry);
+            }
+        }
+
+    public:
+
+        ///
+        /// Creates an empty table.
+        ///
+        table() = default;
+
+        ///
+        /// Copy constructor.
+        ///
+        table(const table& other)
+        {
+            m_count    = other.m_count;
+            m_used     = other.m_used;
+            m_capacity = other.m_capacity;
+
+            if (m_capacity > 0)
+            {
+                m_entries = allocate_array<entry>(m_capacity);
+
+                std::copy(other.m_entries.get(), other.m_entries.get() + m_capacity, m_entries.get());
+            }
+        }
+
+        ///
+        /// Copy assignment operator.
+        ///
+        table& operator=(table other)
+        {
+            std::swap(m_count,    other.m_count);
+            std::swap(m_used,     other.m_used);
+            std::swap(m_capacity, other.m_capacity);
+            std::swap(m_entries,  other.m_entries);
+
+            return *this;
+        }
+
+        ///
+        /// Move constructor.
+        ///
+        table(table&& other) noexcept
+        {
+            std::swap(m_count,    other.m_count);
+            std::swap(m_used,     other.m_used);
+            std::swap(m_capacity, other.m_capacity);
+            std::swap(m_entries,  other.m_entries);
+        }
+
+        ///
+        /// Returns the amount of entries the table contains.
+        ///
+        std::size_t count() const
+        {
+            return m_count;
+        }
+
+        ///
+        /// Returns the amount of slots the table has allocated.
+        ///
+        std::size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        ///
+        /// Returns a pointer to the value stored for a key, or nullptr if there is none.
+        ///
+        value_t* find(const key_t& key) const
+        {
+            if (m_count == 0) return nullptr;
+
+            auto* slot = probe(key, THash{}(key));
+
+            return slot->state == slot_state::FULL ? &slot->value : nullptr;
+        }
+
+        ///
+        /// Returns a pointer to the value of the first key with a given hash that satisfies
+        /// 'match', or nullptr if there is none. (Looks keys up without having to build one.)
+        ///
+        template <typename TMatch>
+        value_t* find(std::size_t hash, TMatch match) const
+        {
+            if (m_count == 0) return nullptr;
+
+            auto* slot = probe(hash, match);
+
+            return slot->state == slot_state::FULL ? &slot->value : nullptr;
+        }
+
+        ///
+        /// Checks whether the table contains a key.
+        ///
+        bool contains(const key_t& key) const
+        {
+            return find(key) != nullptr;
+        }
+
+        ///
+        /// Inserts a key with a value unless it is already present. Returns a pointer to the
+        /// stored value and whether the insertion took place.
+        ///
+        std::pair<value_t*, bool> try_emplace(const key_t& key, value_t value)
+        {
+            return try_emplace(key, THash{}(key), std::move(value));
+        }
+
+        ///
+        /// Inserts a key whose hash the caller has already computed, as try_emplace(key, value).
+        ///
+        std::pair<value_t*, bool> try_emplace(const key_t& key, std::size_t hash, value_t value)
+        {
+            if (m_used + 1 > m_capacity * MAX_LOAD) rehash();
+
+            auto* slot = probe(key, hash);
+
+            if (slot->state == slot_state::FULL) return { &slot->value, false };
+
+            if (slot->state == slot_state::EMPTY) ++m_used;
+            ++m_count;
+
+            slot->key   = key;
+            slot->value = std::move(value);
+            slot->hash  = hash;
+            slot->state = slot_state::FULL;
+
+            return { &slot->value, true };
+        }
+
+        ///
+        /// Stores a value for a key, replacing any previous one. Returns whether the key is new.
+        ///
+        bool set(const key_t& key, value_t value)
+        {
+            auto [stored, inserted] = try_emplace(key, value);
+
+            if (!inserted) *stored = std::move(value);
+
+            return inserted;
+        }
+
+        ///
+        /// Removes a key, leaving a tombstone so that later probes continue past it.
+        /// Returns whether the key was present.
+        ///
+        bool erase(const key_t& key)
+        {
+            if (m_count == 0) return false;
+
+            auto* slot = probe(key, THash{}(key));
+
+            if (slot->state != slot_state::FULL) return false;
+
+            *slot = entry{};
+            slot->state = slot_state::TOMBSTONE;
+            --m_count;
+
+            return true;
+        }
+
+        ///
+        /// Removes every entry for which predicate(key, value) holds.
+        ///
+        template <typename TPredicate>
+        void erase_if(TPredicate predicate)
+        {
+            for (std::size_t i = 0; i < m_capacity; ++i)
+            {
+                auto& slot = m_entries[i];
+
+                if (slot.state != slot_state::FULL || !predicate(slot.key, slot.value)) continue;
+
+                slot = entry{};
+                slot.state = slot_state::TOMBSTONE;
+                --m_count;
+            }
+        }
+
+        ///
+        /// Calls visitor(key, value) for every entry.
+        ///
+        template <typename TVisitor>
+        void for_each(TVisitor visitor) const
+        {
+            for (std::size_t i = 0; i < m_capacity; ++i)
+            {
+                const auto& slot = m_entries[i];
+
+                if (slot.state == slot_state::FULL) visitor(slot.key, slot.value);
+            }
+        }
+    };
+}
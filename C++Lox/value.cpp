@@ -1,113 +1,76 @@
 
+#include <algorithm> // find
+#include <charconv> // from_chars and to_chars
+#include <cmath> // abs and trunc
+
 #include "value.hpp"
 
-lox::value::value()
-    : m_type{ value_type::NIL }
-    , m_inner{}
-{
-}
+// Below this every integer is a double of its own, so its exact digits are also its shortest ones.
+static constexpr double MAX_EXACT_INTEGER = 9007199254740992.0;
 
-lox::value::value(bool value)
-    : m_type{ value_type::BOOL }
-    , m_inner{ value }
+///
+/// Writes an integer-valued double below 1e21 in positional notation and returns the end of the text.
+/// Past MAX_EXACT_INTEGER the shortest digits are padded with zeros, so 123456789012345680000 does not
+/// print as its exact value, 123456789012345683968.
+///
+static char* print_integer(char* first, char* last, double number)
 {
-}
+    if (std::abs(number) < MAX_EXACT_INTEGER) return std::to_chars(first, last, number, std::chars_format::fixed).ptr;
 
-lox::value::value(double value)
-    : m_type{ value_type::NUMBER }
-    , m_inner{ value }
-{
-}
+    // "d.ddde+XX", with as few digits as round-trip.
+    char scientific[32];
 
-lox::value::value(std::shared_ptr<obj> value)
-    : m_type{ value_type::OBJECT }
-    , m_inner{ value }
-{
-}
+    auto* end = std::to_chars(std::begin(scientific), std::end(scientific), number, std::chars_format::scientific).ptr;
 
-lox::value lox::value::nil()
-{
-    return {};
-}
+    const auto* exponent = std::find(scientific, end, 'e');
 
-lox::value lox::value::from(bool value)
-{
-    return { value };
-}
+    int power = 0;
 
-lox::value lox::value::from(double value)
-{
-    return { value };
-}
+    std::from_chars(exponent + (exponent[1] == '+' ? 2 : 1), end, power);
 
-lox::value lox::value::from(std::shared_ptr<obj> value)
-{
-    return { value };
-}
+    auto* out = first;
+    int digits = 0;
 
-bool lox::value::is_nil() const
-{
-    return m_type == value_type::NIL;
-}
-
-bool lox::value::is_boolean() const
-{
-    return m_type == value_type::BOOL;
-}
-
-bool lox::value::is_number() const
-{
-    return m_type == value_type::NUMBER;
-}
-
-bool lox::value::is_object() const
-{
-    return m_type == value_type::OBJECT;
-}
-
-bool lox::value::is_string() const
-{
-    return is_object() && this->as_object()->type() == obj_type::STRING;
-}
+    for (const auto* c = scientific; c != exponent; ++c)
+    {
+        if (*c == '.') continue;
 
-bool lox::value::is_falsey() const
-{
-    return is_nil() || (is_boolean() && !std::get<bool>(m_inner));
-}
+        *out++ = *c;
 
-bool lox::value::as_boolean() const
-{
-    return std::get<bool>(m_inner);
-}
+        if (*c != '-') ++digits;
+    }
 
-double lox::value::as_number() const
-{
-    return std::get<double>(m_inner);
-}
+    for (; digits <= power; ++digits) *out++ = '0';
 
-std::shared_ptr<lox::obj> lox::value::as_object() const
-{
-    return std::get<std::shared_ptr<obj>>(m_inner);
+    return out;
 }
 
-void lox::value::print() const
+void lox::value::print(output_sink& out) const
 {
-    switch (m_type)
+    if (is_boolean())
     {
-    case value_type::BOOL:
-        std::cout << (this->as_boolean() ? "true" : "false");
-        break;
+        out.write(this->as_boolean() ? "true" : "false");
+    }
+    else if (is_nil())
+    {
+        out.write("nil");
+    }
+    else if (is_number())
+    {
+        const auto number = this->as_number();
 
-    case value_type::NIL:
-        std::cout << "nil";
-        break;
+        char text[32];
 
-    case value_type::NUMBER:
-        std::cout << this->as_number();
-        break;
+        // Shortest text that reads back as the same double. Integers print in full, without an exponent,
+        // up to where they would take more than 21 digits, as in JavaScript.
+        const auto* end = std::trunc(number) == number && std::abs(number) < 1e21
+            ? print_integer(std::begin(text), std::end(text), number)
+            : std::to_chars(std::begin(text), std::end(text), number).ptr;
 
-    case value_type::OBJECT:
-        this->as_object()->print();
-        break;
+        out.write({ text, static_cast<std::size_t>(end - text) });
+    }
+    else if (is_object())
+    {
+        this->as_object()->print(out);
     }
 }
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <bit>
 #include <variant>
 
 #include "array.hpp"
@@ -17,40 +18,131 @@ namespace lox
         OBJECT
     };
 
+#ifdef NAN_BOXING
+
+    class value
+    {
+        // Doubles are stored as-is. Anything else lives inside a quiet NaN, with the sign bit
+        // marking object pointers and the two lowest bits tagging the singletons.
+        static constexpr uint64_t SIGN_BIT  = 0x8000000000000000;
+        static constexpr uint64_t QNAN      = 0x7ffc000000000000;
+
+        static constexpr uint64_t TAG_TRUE  = 1; // 01
+        static constexpr uint64_t TAG_NIL   = 2; // 10
+        static constexpr uint64_t TAG_FALSE = 3; // 11
+
+        static constexpr uint64_t TRUE_BITS  = QNAN | TAG_TRUE;
+        static constexpr uint64_t NIL_BITS   = QNAN | TAG_NIL;
+        static constexpr uint64_t FALSE_BITS = QNAN | TAG_FALSE;
+
+        uint64_t m_bits;
+
+    public:
+
+        value() : m_bits{ NIL_BITS } {}
+        value(bool value) : m_bits{ value ? TRUE_BITS : FALSE_BITS } {}
+        value(double value) : m_bits{ std::bit_cast<uint64_t>(value) } {}
+        value(obj* value) : m_bits{ SIGN_BIT | QNAN | reinterpret_cast<uint64_t>(value) } {}
+
+        static value nil() { return {}; }
+        static value from(bool value) { return { value }; }
+        static value from(double value) { return { value }; }
+        static value from(obj* value) { return { value }; }
+
+        // Marks an empty slot, such as a global that was never defined. Never produced by Lox code.
+        static value undefined() { return { static_cast<obj*>(nullptr) }; }
+
+        bool is_undefined() const { return m_bits == (SIGN_BIT | QNAN); }
+        bool is_nil() const { return m_bits == NIL_BITS; }
+        bool is_boolean() const { return (m_bits | TAG_NIL) == FALSE_BITS; }
+        bool is_number() const { return (m_bits & QNAN) != QNAN; }
+        bool is_object() const { return (m_bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN); }
+        bool is_string() const { return is_object() && (as_object()->type() == obj_type::STRING || as_object()->type() == obj_type::ROPE); }
+        bool is_rope() const { return is_object() && as_object()->type() == obj_type::ROPE; }
+
+        // nil and false are the only values whose bits are QNAN | 1x.
+        bool is_falsey() const { return (m_bits | TAG_TRUE) == FALSE_BITS; }
+
+        bool as_boolean() const { return m_bits == TRUE_BITS; }
+        double as_number() const { return std::bit_cast<double>(m_bits); }
+        obj* as_object() const { return reinterpret_cast<obj*>(m_bits & ~(SIGN_BIT | QNAN)); }
+
+        void print(output_sink& out) const;
+
+        template <typename T> friend struct std::equal_to;
+
+        template <typename T> friend struct std::hash;
+
+        friend struct identical;
+    };
+
+#else
+
     class value
     {
         value_type m_type;
-        std::variant<std::monostate, bool, double, std::shared_ptr<obj>> m_inner;
+        std::variant<std::monostate, bool, double, obj*> m_inner;
 
     public:
 
-        value();
-        value(bool);
-        value(double);
-        value(std::shared_ptr<obj>);
+        value() : m_type{ value_type::NIL }, m_inner{} {}
+        value(bool value) : m_type{ value_type::BOOL }, m_inner{ value } {}
+        value(double value) : m_type{ value_type::NUMBER }, m_inner{ value } {}
+        value(obj* value) : m_type{ value_type::OBJECT }, m_inner{ value } {}
 
-        static value nil();
-        static value from(bool value);
-        static value from(double value);
-        static value from(std::shared_ptr<obj> value);
+        static value nil() { return {}; }
+        static value from(bool value) { return { value }; }
+        static value from(double value) { return { value }; }
+        static value from(obj* value) { return { value }; }
 
-        bool is_nil() const;
-        bool is_boolean() const;
-        bool is_number() const;
-        bool is_object() const;
-        bool is_string() const;
-        bool is_falsey() const;
+        // Marks an empty slot, such as a global that was never defined. Never produced by Lox code.
+        static value undefined() { return { static_cast<obj*>(nullptr) }; }
 
-        bool as_boolean() const;
-        double as_number() const;
-        std::shared_ptr<obj> as_object() const;
+        bool is_undefined() const { return is_object() && as_object() == nullptr; }
+        bool is_nil() const { return m_type == value_type::NIL; }
+        bool is_boolean() const { return m_type == value_type::BOOL; }
+        bool is_number() const { return m_type == value_type::NUMBER; }
+        bool is_object() const { return m_type == value_type::OBJECT; }
+        bool is_string() const { return is_object() && (as_object()->type() == obj_type::STRING || as_object()->type() == obj_type::ROPE); }
+        bool is_rope() const { return is_object() && as_object()->type() == obj_type::ROPE; }
+        bool is_falsey() const { return is_nil() || (is_boolean() && !as_boolean()); }
 
-        void print() const;
+        bool as_boolean() const { return std::get<bool>(m_inner); }
+        double as_number() const { return std::get<double>(m_inner); }
+        obj* as_object() const { return std::get<obj*>(m_inner); }
+
+        void print(output_sink& out) const;
 
         template <typename T> friend struct std::equal_to;
+
+        template <typename T> friend struct std::hash;
+
+        friend struct identical;
     };
 
-    using value_array = array<value, uint8_t>;
+#endif // NAN_BOXING
+
+    using value_array = array<value>;
+
+    ///
+    /// Compares two values by representation rather than by Lox equality,
+    /// so that NaN matches itself and 0 does not match -0.
+    ///
+    struct identical
+    {
+        bool operator()(const value& lhs, const value& rhs) const
+        {
+#ifdef NAN_BOXING
+            return lhs.m_bits == rhs.m_bits;
+#else
+            if (lhs.m_type != rhs.m_type) return false;
+
+            if (lhs.is_number()) return std::bit_cast<uint64_t>(lhs.as_number()) == std::bit_cast<uint64_t>(rhs.as_number());
+
+            return lhs.m_inner == rhs.m_inner;
+#endif // NAN_BOXING
+        }
+    };
 }
 
 namespace std
@@ -60,6 +152,12 @@ namespace std
     {
         bool operator()(const lox::value& lhs, const lox::value& rhs) const
         {
+#ifdef NAN_BOXING
+            // Numbers compare as doubles so that NaN != NaN; everything else is interned or a singleton.
+            if (lhs.is_number() && rhs.is_number()) return lhs.as_number() == rhs.as_number();
+
+            return lhs.m_bits == rhs.m_bits;
+#else
             lox::value_type type;
             if ((type = lhs.m_type) != rhs.m_type) return false;
 
@@ -72,6 +170,28 @@ namespace std
             }
 
             return false;
+#endif // NAN_BOXING
+        }
+    };
+
+    template <>
+    struct std::hash<lox::value>
+    {
+        std::size_t operator()(const lox::value& value) const
+        {
+#ifdef NAN_BOXING
+            return std::hash<uint64_t>{}(value.m_bits);
+#else
+            switch (value.m_type)
+            {
+            case lox::value_type::BOOL:   return std::hash<bool>{}(value.as_boolean());
+            case lox::value_type::NIL:    return 0;
+            case lox::value_type::NUMBER: return std::hash<uint64_t>{}(std::bit_cast<uint64_t>(value.as_number()));
+            case lox::value_type::OBJECT: return std::hash<lox::obj*>{}(value.as_object());
+            }
+
+            return 0;
+#endif // NAN_BOXING
         }
     };
 }
@@ -5,227 +5,770 @@
 #include "debug.hpp"
 #include "memory.hpp"
 
-lox::vm::vm(lox::chunk& chunk) 
+lox::vm::vm(lox::chunk& chunk, std::size_t stack_size)
+    : vm{ chunk, m_pool, stack_size }
+{
+}
+
+lox::vm::vm(lox::chunk& chunk, allocator& allocator, std::size_t stack_size)
     : m_chunk{ chunk }
     , m_ip{ 0 }
-    , m_stack{}
+    , m_stack{ stack_size }
     , m_strings{}
-    , m_globals{}
+    , m_global_slots{}
+    , m_global_names{}
+    , m_global_values{}
+    , m_allocator{ allocator }
+    , m_gray_stack{}
 {
 }
 
 lox::vm::~vm()
 {
-    // TODO :/ ?
+    m_output.flush();
+
+    auto* object = m_objects;
 
-    auto* obj = vm::objects;
+    while (object)
+    {
+        auto* next = object->m_next;
 
-    //while (obj)
-    //{
-    //    auto* next = obj->next;
+        free_object(object);
 
-    //}
-}
+        object = next;
+    }
+
+    m_objects = nullptr;
 
-lox::obj* lox::vm::objects = nullptr;
+#ifdef DEBUG_LOG_GC
+    std::cout << "-- allocations by size class\n";
+
+    for (const auto& size_class : m_pool.stats())
+    {
+        if (size_class.allocations == 0) continue;
+
+        std::cout << std::format("   {:>5} bytes: {} allocated, {} freed, {} bytes reserved\n",
+            size_class.block_size == 0 ? std::string{ "large" } : std::to_string(size_class.block_size),
+            size_class.allocations, size_class.deallocations, size_class.reserved_bytes);
+    }
+#endif // DEBUG_LOG_GC
+}
 
 lox::interpret_result lox::vm::run()
 {
-    const auto read_byte = [this]()
+    const auto* const code = &m_chunk.get(0);
+    const auto& constants = m_chunk.constants();
+
+    // The instruction pointer and the stack top live in registers; m_ip and the stack are only synced
+    // back when leaving the loop, and the stack also around calls that work on it.
+    const auto* ip = code + m_ip;
+
+    auto* top = m_stack.top();
+
+    const auto read_long = [&ip]()
     {
-        return m_chunk.get(m_ip++);
+        const auto operand = read_long_operand(ip);
+        ip += 3;
+        return operand;
     };
 
-    const auto read_constant = [this, &read_byte]()
+    const auto save_ip = [this, code, &ip, &top]()
     {
-        return m_chunk.constants().get(read_byte().op);
+        m_ip = static_cast<chunk::idx_t>(ip - code);
+        m_stack.set_top(top);
     };
 
-    const auto binary_op = [this](auto operation)
+    // Runs a member function that pushes, pops or allocates (and so may mark the stack) on the synced stack.
+    const auto with_stack = [this, &top](auto operation)
     {
-        if (!m_stack.peek(0).is_number() || !m_stack.peek(1).is_number())
+        m_stack.set_top(top);
+        const auto result = operation();
+        top = m_stack.top();
+        return result;
+    };
+
+    const auto undefined_variable = [this, &save_ip](std::size_t slot)
+    {
+        save_ip();
+        runtime_error("Undefined variable '{0}'.", m_global_names.get(slot)->chars());
+
+        return interpret_result::RUNTIME_ERROR;
+    };
+
+    const auto binary_op = [&top](auto operation)
+    {
+        if (!top[-1].is_number() || !top[-2].is_number())
+        {
+            return false;
+        }
+        const auto b = (*--top).as_number();
+        const auto a = top[-1].as_number();
+        top[-1] = value::from(operation(a, b));
+        return true;
+    };
+
+    const auto add = [this, &top, &binary_op, &with_stack]()
+    {
+        if (top[-1].is_string() && top[-2].is_string())
         {
-            runtime_error("Operands must be numbers.");
-            throw interpret_result::RUNTIME_ERROR;
+            return with_stack([this]() { return concatenate(2); }) ? add_result::OK : add_result::TOO_LONG;
         }
-        const auto b = m_stack.pop().as_number();
-        const auto a = m_stack.pop().as_number();
-        m_stack.push(value::from(operation(a, b)));
+
+        return binary_op(std::plus{}) ? add_result::OK : add_result::BAD_OPERANDS;
     };
 
+    // Why the last addition failed, for the error reported at add_failed.
+    auto add_failure = add_result::OK;
+
+    const auto push_global = [this, &top](std::size_t slot)
+    {
+        const auto& global = m_global_values.get(slot);
+
+        if (global.is_undefined()) return false;
+
+        *top++ = global;
+        return true;
+    };
+
+#ifdef COMPUTED_GOTO
+    // Indexed by op_code, so it must list every label in enum order.
+    static void* const dispatch_table[] =
+    {
+        &&do_OP_CONSTANT,
+        &&do_OP_CONSTANT_LONG,
+        &&do_OP_NIL,
+        &&do_OP_TRUE,
+        &&do_OP_FALSE,
+        &&do_OP_POP,
+        &&do_OP_GET_GLOBAL_SLOT,
+        &&do_OP_GET_GLOBAL_SLOT_LONG,
+        &&do_OP_DEFINE_GLOBAL_SLOT,
+        &&do_OP_DEFINE_GLOBAL_SLOT_LONG,
+        &&do_OP_EQUAL,
+        &&do_OP_NOT_EQUAL,
+        &&do_OP_GREATER,
+        &&do_OP_GREATER_EQUAL,
+        &&do_OP_LESS,
+        &&do_OP_LESS_EQUAL,
+        &&do_OP_ADD,
+        &&do_OP_CONCAT_N,
+        &&do_OP_SUBTRACT,
+        &&do_OP_MULTIPLY,
+        &&do_OP_DIVIDE,
+        &&do_OP_NOT,
+        &&do_OP_NEGATE,
+        &&do_OP_PRINT,
+        &&do_OP_ADD_GLOBALS,
+        &&do_OP_RETURN
+    };
+
+    static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) == op_code::OP_RETURN + 1);
+
+#define VM_DISPATCH()  goto *dispatch_table[*ip++];
+#define VM_CASE(op)    do_##op:
+#define VM_NEXT()      goto *dispatch_table[*ip++]
+#else
+#define VM_DISPATCH()  switch (*ip++)
+#define VM_CASE(op)    case op_code::op:
+#define VM_NEXT()      break
+#endif // COMPUTED_GOTO
+
 #ifdef _DEBUG
+    // The trace goes straight to std::cout, so whatever was printed has to be written out first.
+    m_output.flush();
+
     std::cout << "\n== trace ==";
 #endif // _DEBUG
 
     while (true)
     {
 #ifdef _DEBUG
+        m_stack.set_top(top);
+
+        m_output.flush();
+
         std::cout << "          ";
 
-        for (lox::stack<value>::idx_t i = 0; i < m_stack.count(); ++i)
+        for (std::size_t i = 0; i < m_stack.count(); ++i)
         {
             std::cout << "[ ";
 
-            m_stack.get(i).print();
+            m_stack.get(i).print(m_output);
+
+            m_output.flush();
 
             std::cout << " ]";
         }
 
         std::cout << '\n';
 
-        disassemble_instruction(m_chunk, m_ip);
+        disassemble_instruction(m_chunk, static_cast<chunk::idx_t>(ip - code), m_output);
 #endif // DEBUG
 
-        try
+        VM_DISPATCH()
         {
-            switch (read_byte().op)
-            {
-            case op_code::OP_CONSTANT:
-                m_stack.push(read_constant());
-                break;
+            VM_CASE(OP_CONSTANT)
+                *top++ = constants.get(*ip++);
+                VM_NEXT();
 
-            case op_code::OP_NIL:
-                m_stack.push(value::nil());
-                break;
+            VM_CASE(OP_CONSTANT_LONG)
+                *top++ = constants.get(read_long());
+                VM_NEXT();
 
-            case op_code::OP_TRUE:
-                m_stack.push(value::from(true));
-                break;
+            VM_CASE(OP_NIL)
+                *top++ = value::nil();
+                VM_NEXT();
 
-            case op_code::OP_FALSE:
-                m_stack.push(value::from(false));
-                break;
+            VM_CASE(OP_TRUE)
+                *top++ = value::from(true);
+                VM_NEXT();
 
-            case op_code::OP_POP:
-                m_stack.pop();
-                break;
+            VM_CASE(OP_FALSE)
+                *top++ = value::from(false);
+                VM_NEXT();
 
-            case op_code::OP_GET_GLOBAL:
-                {
-                    auto name = static_pointer_cast<obj_string>(read_constant().as_object());
+            VM_CASE(OP_POP)
+                --top;
+                VM_NEXT();
 
-                    if (!m_globals.contains(name))
-                    {
-                        runtime_error("Undefined variable '{0}'.", name->chars());
-                        return interpret_result::RUNTIME_ERROR;
-                    }
+            VM_CASE(OP_GET_GLOBAL_SLOT)
+                {
+                    const auto slot = *ip++;
 
-                    m_stack.push(m_globals[name]);
-                    break;
+                    if (!push_global(slot)) return undefined_variable(slot);
                 }
+                VM_NEXT();
 
-            case op_code::OP_DEFINE_GLOBAL:
+            VM_CASE(OP_GET_GLOBAL_SLOT_LONG)
                 {
-                    auto name = static_pointer_cast<obj_string>(read_constant().as_object());
-                    m_globals[name] = m_stack.pop();
-                }
-                break;
+                    const auto slot = read_long();
 
-            case op_code::OP_EQUAL:
-                {
-                    const auto a = m_stack.pop();
-                    const auto b = m_stack.pop();
-                    m_stack.push(value::from(std::equal_to<value>{}(a, b)));
+                    if (!push_global(slot)) return undefined_variable(slot);
                 }
-                break;
+                VM_NEXT();
 
-            case op_code::OP_GREATER:
-                binary_op(std::greater{});
-                break;
+            VM_CASE(OP_DEFINE_GLOBAL_SLOT)
+                m_global_values.get(*ip++) = *--top;
+                VM_NEXT();
 
-            case op_code::OP_LESS:
-                binary_op(std::less{});
-                break;
+            VM_CASE(OP_DEFINE_GLOBAL_SLOT_LONG)
+                m_global_values.get(read_long()) = *--top;
+                VM_NEXT();
 
-            case op_code::OP_ADD:
-                if (m_stack.peek(0).is_string() && m_stack.peek(1).is_string())
+            VM_CASE(OP_EQUAL)
                 {
-                    concatenate();
+                    with_stack([this]() { flatten_operands(); return true; });
+                    const auto a = *--top;
+                    top[-1] = value::from(std::equal_to<value>{}(a, top[-1]));
                 }
-                else if (m_stack.peek(0).is_number() && m_stack.peek(1).is_number())
+                VM_NEXT();
+
+            VM_CASE(OP_NOT_EQUAL)
                 {
-                    binary_op(std::plus{});
+                    with_stack([this]() { flatten_operands(); return true; });
+                    const auto a = *--top;
+                    top[-1] = value::from(!std::equal_to<value>{}(a, top[-1]));
                 }
-                else
-                {
-                    runtime_error("Operands must be two numbers or two strings.");
+                VM_NEXT();
 
-                    return interpret_result::RUNTIME_ERROR;
-                }
-                break;
+            VM_CASE(OP_GREATER)
+                if (!binary_op(std::greater{})) goto operands_must_be_numbers;
+                VM_NEXT();
+
+            // Fused 'less, not' and 'greater, not' keep the negation so NaN compares as before.
+            VM_CASE(OP_GREATER_EQUAL)
+                if (!binary_op([](double a, double b) { return !(a < b); })) goto operands_must_be_numbers;
+                VM_NEXT();
 
-            case op_code::OP_SUBTRACT:
-                binary_op(std::minus{});
-                break;
+            VM_CASE(OP_LESS)
+                if (!binary_op(std::less{})) goto operands_must_be_numbers;
+                VM_NEXT();
 
-            case op_code::OP_MULTIPLY:
-                binary_op(std::multiplies{});
-                break;
+            VM_CASE(OP_LESS_EQUAL)
+                if (!binary_op([](double a, double b) { return !(a > b); })) goto operands_must_be_numbers;
+                VM_NEXT();
 
-            case op_code::OP_DIVIDE:
-                binary_op(std::divides{});
-                break;
+            VM_CASE(OP_ADD)
+                if ((add_failure = add()) != add_result::OK) goto add_failed;
+                VM_NEXT();
 
-            case op_code::OP_NOT:
-                m_stack.push(value::from(m_stack.pop().is_falsey()));
-                break;
+            VM_CASE(OP_CONCAT_N)
+                if ((add_failure = with_stack([this, count = *ip++]() { return add_n(count); })) != add_result::OK) goto add_failed;
+                VM_NEXT();
 
-            case op_code::OP_NEGATE:
-                if (!m_stack.peek().is_number())
+            VM_CASE(OP_SUBTRACT)
+                if (!binary_op(std::minus{})) goto operands_must_be_numbers;
+                VM_NEXT();
+
+            VM_CASE(OP_MULTIPLY)
+                if (!binary_op(std::multiplies{})) goto operands_must_be_numbers;
+                VM_NEXT();
+
+            VM_CASE(OP_DIVIDE)
+                if (!binary_op(std::divides{})) goto operands_must_be_numbers;
+                VM_NEXT();
+
+            VM_CASE(OP_NOT)
+                top[-1] = value::from(top[-1].is_falsey());
+                VM_NEXT();
+
+            VM_CASE(OP_NEGATE)
+                if (!top[-1].is_number())
                 {
+                    save_ip();
                     runtime_error("Operand must be a number.");
 
                     return interpret_result::RUNTIME_ERROR;
                 }
-                m_stack.push(value::from(-m_stack.pop().as_number()));
-                break;
+                top[-1] = value::from(-top[-1].as_number());
+                VM_NEXT();
+
+            VM_CASE(OP_PRINT)
+                (*--top).print(m_output);
+                m_output.put('\n');
+                VM_NEXT();
+
+            VM_CASE(OP_ADD_GLOBALS)
+                {
+                    for (auto i = 0; i < 2; ++i)
+                    {
+                        const auto slot = *ip++;
+
+                        if (!push_global(slot)) return undefined_variable(slot);
+                    }
 
-            case op_code::OP_PRINT:
-                m_stack.pop().print();
-                std::cout << '\n';
-                break;
+                    if ((add_failure = add()) != add_result::OK) goto add_failed;
+                }
+                VM_NEXT();
 
-            case op_code::OP_RETURN:
+            VM_CASE(OP_RETURN)
+                save_ip();
                 return interpret_result::OK;
-            }
         }
-        catch (const interpret_result result)
+    }
+
+operands_must_be_numbers:
+    save_ip();
+    runtime_error("Operands must be numbers.");
+
+    return interpret_result::RUNTIME_ERROR;
+
+add_failed:
+    save_ip();
+    runtime_error(add_failure == add_result::TOO_LONG ? "String is too long." : "Operands must be two numbers or two strings.");
+
+    return interpret_result::RUNTIME_ERROR;
+
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_NEXT
+}
+
+///
+/// Returns the flat string standing in for a rope that has already been flattened, so that
+/// new ropes do not keep its node alive.
+///
+static lox::obj* rope_piece(lox::obj* string)
+{
+    if (string->type() == lox::obj_type::ROPE)
+    {
+        if (auto* flat = static_cast<lox::obj_rope*>(string)->flat()) return flat;
+    }
+
+    return string;
+}
+
+///
+/// Appends the characters of a string object, flat or rope, to 'text'.
+///
+static void append_string(std::string& text, const lox::obj* string)
+{
+    if (string->type() == lox::obj_type::STRING)
+    {
+        const auto* flat = static_cast<const lox::obj_string*>(string);
+
+        text.append(flat->chars(), flat->length());
+    }
+    else
+    {
+        static_cast<const lox::obj_rope*>(string)->for_each_piece([&text](std::string_view piece) { text.append(piece); });
+    }
+}
+
+lox::vm::add_result lox::vm::add_n(std::size_t count)
+{
+    const auto first = count - 1;
+
+    if (m_stack.peek(first).is_number())
+    {
+        // Summed left to right, exactly as a chain of OP_ADD would.
+        auto sum = m_stack.peek(first).as_number();
+
+        for (auto depth = first; depth-- > 0;)
         {
-            return result;
+            if (!m_stack.peek(depth).is_number()) return add_result::BAD_OPERANDS;
+
+            sum += m_stack.peek(depth).as_number();
         }
+
+        m_stack.pop(count);
+        m_stack.push(value::from(sum));
+
+        return add_result::OK;
+    }
+
+    for (std::size_t depth = 0; depth < count; ++depth)
+    {
+        if (!m_stack.peek(depth).is_string()) return add_result::BAD_OPERANDS;
+    }
+
+    return concatenate(count) ? add_result::OK : add_result::TOO_LONG;
+}
+
+bool lox::vm::concatenate(std::size_t count)
+{
+    const auto first = count - 1;
+
+    std::size_t length = 0;
+    auto has_long_piece = false;
+
+    for (std::size_t depth = 0; depth < count; ++depth)
+    {
+        const auto piece_length = string_length(m_stack.peek(depth).as_object());
+
+        length += piece_length;
+        has_long_piece |= piece_length >= MIN_ROPE_LENGTH;
+    }
+
+    // Checked before building anything: a rope is never longer than the string it flattens into.
+    if (length > obj_string::MAX_LENGTH) return false;
+
+    // The operands stay on the stack until the result exists, in case allocating collects garbage.
+    if (!has_long_piece)
+    {
+        // Short pieces are copied once into a single string of the exact total length.
+        m_text.clear();
+        m_text.reserve(length);
+
+        for (auto depth = count; depth-- > 0;)
+        {
+            append_string(m_text, m_stack.peek(depth).as_object());
+        }
+
+        m_stack.peek(first) = value::from(copy_string(m_text));
+    }
+    else
+    {
+        // Copying a long piece on every append would make building a string quadratic, so link
+        // ropes instead. Each partial result is kept in the first operand's slot, where it stays a root.
+        for (auto depth = first; depth-- > 0;)
+        {
+            auto* left = rope_piece(m_stack.peek(first).as_object());
+            auto* right = rope_piece(m_stack.peek(depth).as_object());
+
+            m_stack.peek(first) = value::from(allocate_object<obj_rope>(left, right));
+        }
+    }
+
+    m_stack.pop(first);
+
+    return true;
+}
+
+lox::obj_string* lox::vm::flatten(obj_rope* rope)
+{
+    if (rope->flat()) return rope->flat();
+
+    m_text.clear();
+    m_text.reserve(rope->length());
+
+    append_string(m_text, rope);
+
+    // The rope is reachable from the caller's stack slot, so its halves survive until interned.
+    rope->flatten(copy_string(m_text));
+
+    return rope->flat();
+}
+
+void lox::vm::flatten_operands()
+{
+    for (std::size_t depth = 0; depth < 2; ++depth)
+    {
+        auto& operand = m_stack.peek(depth);
+
+        if (operand.is_rope()) operand = value::from(flatten(static_cast<obj_rope*>(operand.as_object())));
+    }
+}
+
+lox::obj_string* lox::vm::copy_string(std::string_view text)
+{
+    const auto hash = hash_string(text);
+
+    if (auto* interned = m_strings.find(hash, [text](std::string_view key) { return key == text; }))
+    {
+        return *interned;
     }
+
+    auto* string = allocate_object<obj_string>(text, hash);
+
+    // Key on the string's own characters, which outlive the buffer 'text' points into.
+    m_strings.try_emplace({ string->chars(), string->length() }, hash, string);
+
+    return string;
 }
 
-void lox::vm::concatenate()
+std::size_t lox::vm::global_slot(obj_string* name)
 {
-    auto b = std::static_pointer_cast<obj_string>(m_stack.pop().as_object());
-    auto a = std::static_pointer_cast<obj_string>(m_stack.pop().as_object());
+    auto [entry, inserted] = m_global_slots.try_emplace(name, m_global_values.count());
 
-    a->concat(*b);
+    if (inserted)
+    {
+        m_global_names.add(name);
+        m_global_values.add(value::undefined());
+    }
 
-    m_stack.push(value::from(a));
+    return *entry;
 }
 
 void lox::vm::runtime_error(const std::string_view format, const auto&&... params)
 {
+    // Whatever the program printed comes before the error.
+    m_output.flush();
+
     std::cerr << std::vformat(format, std::make_format_args(params...)) << '\n';
 
-    auto instruction = m_ip - m_chunk.count() - 1;
-    auto line = m_chunk.get(instruction).line;
+    auto instruction = m_ip - 1;
+    auto line = m_chunk.line(instruction);
     std::cerr << std::format("[line {}] in script\n", line);
 
     m_stack.reset();
 }
 
+void lox::vm::mark_value(const value& value)
+{
+    if (value.is_object()) mark_object(value.as_object());
+}
+
+void lox::vm::mark_object(obj* object)
+{
+    if (object == nullptr || object->m_is_marked) return;
+
+#ifdef DEBUG_LOG_GC
+    std::cout << std::format("{} mark ", static_cast<void*>(object));
+    value::from(object).print(m_output);
+    m_output.put('\n');
+    m_output.flush();
+#endif // DEBUG_LOG_GC
+
+    object->m_is_marked = true;
+
+    m_gray_stack.push(object);
+}
+
+void lox::vm::mark_roots()
+{
+    for (std::size_t i = 0; i < m_stack.count(); ++i)
+    {
+        mark_value(m_stack.get(i));
+    }
+
+    for (std::size_t i = 0; i < m_global_values.count(); ++i)
+    {
+        mark_object(m_global_names.get(i));
+        mark_value(m_global_values.get(i));
+    }
+
+    const auto& constants = m_chunk.constants();
+
+    for (std::size_t i = 0; i < constants.count(); ++i)
+    {
+        mark_value(constants.get(static_cast<value_array::idx_t>(i)));
+    }
+}
+
+void lox::vm::trace_references()
+{
+    while (m_gray_stack.count() > 0)
+    {
+        auto* object = m_gray_stack.pop();
+
+        switch (object->type())
+        {
+        case obj_type::STRING:
+            break; // Strings hold no references.
+
+        case obj_type::ROPE:
+            {
+                auto* rope = static_cast<obj_rope*>(object);
+
+                mark_object(rope->m_left);
+                mark_object(rope->m_right);
+                mark_object(rope->m_flat);
+            }
+            break;
+        }
+    }
+}
+
+void lox::vm::remove_white_strings()
+{
+    m_strings.erase_if([](std::string_view, obj_string* string) { return !string->m_is_marked; });
+}
+
+void lox::vm::sweep()
+{
+    obj* previous = nullptr;
+    obj* object = m_objects;
+
+    while (object)
+    {
+        if (object->m_is_marked)
+        {
+            object->m_is_marked = false;
+
+            previous = object;
+            object = object->m_next;
+
+            continue;
+        }
+
+        auto* unreached = object;
+        object = object->m_next;
+
+        if (previous)
+        {
+            previous->m_next = object;
+        }
+        else
+        {
+            m_objects = object;
+        }
+
+        free_object(unreached);
+    }
+}
+
+void lox::vm::free_object(obj* object)
+{
+#ifdef DEBUG_LOG_GC
+    std::cout << std::format("{} free type {}\n", static_cast<void*>(object), static_cast<int>(object->type()));
+#endif // DEBUG_LOG_GC
+
+    m_bytes_allocated -= object->size();
+
+    switch (object->type())
+    {
+    case obj_type::STRING: obj_string::destroy(m_allocator, static_cast<obj_string*>(object)); break;
+    case obj_type::ROPE:   obj_rope::destroy(m_allocator, static_cast<obj_rope*>(object));     break;
+    }
+}
+
+void lox::vm::collect_garbage()
+{
+#ifdef DEBUG_LOG_GC
+    std::cout << "-- gc begin\n";
+    auto before = m_bytes_allocated;
+#endif // DEBUG_LOG_GC
+
+    mark_roots();
+    trace_references();
+    remove_white_strings();
+    sweep();
+
+    m_next_gc = std::max(m_bytes_allocated * GC_HEAP_GROW_FACTOR, GC_INITIAL_THRESHOLD);
+
+#ifdef DEBUG_LOG_GC
+    std::cout << "-- gc end\n";
+    std::cout << std::format("   collected {} bytes (from {} to {}) next at {}\n", before - m_bytes_allocated, before, m_bytes_allocated, m_next_gc);
+#endif // DEBUG_LOG_GC
+}
+
+std::size_t lox::vm::bytes_allocated() const
+{
+    return m_bytes_allocated;
+}
+
+std::size_t lox::vm::interned_capacity() const
+{
+    return m_strings.capacity();
+}
+
+const lox::pool_allocator::stats_t& lox::vm::allocation_stats() const
+{
+    return m_pool.stats();
+}
+
+void lox::vm::set_optimization_level(int level)
+{
+    m_optimization_level = level;
+}
+
+lox::output_sink& lox::vm::output()
+{
+    return m_output;
+}
+
+///
+/// Returns the offset of the first instruction from 'start' on that would take the stack
+/// past 'capacity', starting from 'depth' values, if there is one.
+///
+static std::optional<lox::chunk::idx_t> find_stack_overflow(const lox::chunk& chunk, lox::chunk::idx_t start, std::ptrdiff_t depth, std::ptrdiff_t capacity)
+{
+    // There are no jumps, so every instruction runs once and in order.
+    for (auto offset = start; offset < chunk.count(); offset += lox::instruction_length(chunk.get(offset)))
+    {
+        const auto* instruction = &chunk.get(offset);
+
+        if (depth + lox::stack_peak(instruction) > capacity) return offset;
+
+        depth += lox::stack_effect(instruction);
+    }
+
+    return std::nullopt;
+}
+
 lox::interpret_result lox::vm::interpret(const std::string_view source)
 {
-    lox::compiler compiler{ source, m_chunk, m_strings };
+    // The chunk is shared by every REPL line, so each one runs from where its own code begins.
+    const auto start = m_chunk.count();
+
+    if (!compile(source)) return interpret_result::COMPILE_ERROR;
+
+    return execute(start);
+}
+
+bool lox::vm::compile(const std::string_view source)
+{
+    const auto start = m_chunk.count();
+
+    lox::compiler compiler{ source, *this };
 
     if (!compiler.compile())
     {
-        return interpret_result::COMPILE_ERROR;
+        m_chunk.truncate(start);
+
+        return false;
     }
 
+    return true;
+}
+
+lox::interpret_result lox::vm::execute(chunk::idx_t start)
+{
+    // The one overflow check: pushes in run() are unchecked.
+    if (const auto overflow = find_stack_overflow(m_chunk, start, static_cast<std::ptrdiff_t>(m_stack.count()), static_cast<std::ptrdiff_t>(m_stack.capacity())))
+    {
+        m_ip = overflow.value() + 1;
+
+        runtime_error("Stack overflow.");
+
+        m_chunk.truncate(start);
+
+        return interpret_result::RUNTIME_ERROR;
+    }
+
+    m_ip = start;
+
     auto result = run();
 
     return result;
@@ -3,7 +3,10 @@
 
 #include "chunk.hpp"
 #include "common.hpp"
+#include "memory.hpp"
+#include "output.hpp"
 #include "stack.hpp"
+#include "table.hpp"
 
 namespace lox
 {
@@ -16,30 +19,189 @@ namespace lox
 
     class vm
     {
+        static constexpr std::size_t GC_INITIAL_THRESHOLD = 1024 * 1024;
+
+        static constexpr std::size_t GC_HEAP_GROW_FACTOR = 2;
+
+        // Concatenations shorter than this are copied and interned right away; longer ones become ropes.
+        static constexpr std::size_t MIN_ROPE_LENGTH = 64;
+
         chunk& m_chunk;
 
         chunk::idx_t m_ip;
 
-        stack<value> m_stack;
+        fixed_stack<value> m_stack;
+
+        // Interned strings, keyed by their own characters. Entries are weak: unmarked strings are dropped before sweeping.
+        table<std::string_view, obj_string*, string_hash> m_strings;
+
+        // Globals are resolved to dense slots at compile time; undefined ones hold value::undefined().
+        table<obj_string*, std::size_t, obj_string_hash> m_global_slots;
+
+        array<obj_string*> m_global_names;
+
+        array<value> m_global_values;
+
+        // Backs every heap object unless the VM is given another allocator.
+        pool_allocator m_pool;
 
-        std::unordered_map<std::string_view, std::shared_ptr<obj_string>> m_strings;
+        // Where heap objects are allocated and freed: m_pool, or the allocator the VM was created with.
+        allocator& m_allocator;
 
-        std::unordered_map<std::shared_ptr<obj_string>, value> m_globals;
+        obj* m_objects = nullptr;
+
+        stack<obj*> m_gray_stack;
+
+        std::size_t m_bytes_allocated = 0;
+
+        std::size_t m_next_gc = GC_INITIAL_THRESHOLD;
+
+        int m_optimization_level = 1;
+
+        // Scratch buffer for building string contents, reused so that each new string costs one allocation.
+        std::string m_text;
+
+        // Where print statements write.
+        output_sink m_output{ std::cout };
 
         interpret_result run();
 
-        void concatenate();
+        // How an addition that may concatenate strings went.
+        enum class add_result
+        {
+            OK,
+            BAD_OPERANDS,
+            TOO_LONG
+        };
+
+        ///
+        /// Replaces the top 'count' values with their sum, left to right. They must be all numbers or all strings.
+        ///
+        add_result add_n(std::size_t count);
+
+        ///
+        /// Replaces the top 'count' strings with their concatenation. Returns false, leaving the stack
+        /// as it was, if the result would be longer than obj_string::MAX_LENGTH.
+        ///
+        bool concatenate(std::size_t count);
+
+        obj_string* flatten(obj_rope* rope);
+
+        void flatten_operands();
+
+        ///
+        /// Returns the slot of a global variable, reserving an undefined one the first time a name is seen.
+        ///
+        std::size_t global_slot(obj_string* name);
 
         void runtime_error(const std::string_view format, const auto&&... params);
 
+        void mark_value(const value& value);
+
+        void mark_object(obj* object);
+
+        void mark_roots();
+
+        void trace_references();
+
+        void remove_white_strings();
+
+        void sweep();
+
+        void free_object(obj* object);
+
+        friend class compiler;
+
+        friend class bytecode_file;
+
     public:
 
-        static obj* objects;
+        // Values the stack holds unless the VM is created with another size.
+        static constexpr std::size_t DEFAULT_STACK_SIZE = 16 * 1024;
 
-        vm(lox::chunk& chunk);
+        vm(lox::chunk& chunk, std::size_t stack_size = DEFAULT_STACK_SIZE);
+
+        ///
+        /// Creates a VM whose heap objects come from 'allocator', which must outlive it.
+        ///
+        vm(lox::chunk& chunk, allocator& allocator, std::size_t stack_size = DEFAULT_STACK_SIZE);
 
         ~vm();
 
+        ///
+        /// Allocates a heap object owned by this VM, collecting garbage first if the heap has outgrown its threshold.
+        ///
+        template
+        <
+            typename TObj,
+            typename... TArgs
+        >
+        TObj* allocate_object(TArgs&&... args)
+        {
+#ifdef DEBUG_STRESS_GC
+            collect_garbage();
+#else
+            if (m_bytes_allocated > m_next_gc) collect_garbage();
+#endif // DEBUG_STRESS_GC
+
+            auto* object = TObj::create(m_allocator, std::forward<TArgs>(args)...);
+
+            object->m_next = m_objects;
+            m_objects = object;
+
+            m_bytes_allocated += object->size();
+
+            return object;
+        }
+
+        ///
+        /// Returns the interned string with the given characters, allocating it on first use.
+        /// 'text' must be at most obj_string::MAX_LENGTH long.
+        ///
+        obj_string* copy_string(std::string_view text);
+
+        ///
+        /// Marks every object reachable from the roots and frees the rest.
+        ///
+        void collect_garbage();
+
+        ///
+        /// Returns the amount of heap bytes currently owned by live or not yet collected objects.
+        ///
+        std::size_t bytes_allocated() const;
+
+        ///
+        /// Returns the amount of slots the string interner has allocated.
+        ///
+        std::size_t interned_capacity() const;
+
+        ///
+        /// Returns the allocation counters of the VM's own object pool, per size class.
+        /// (All zero when the VM was created with another allocator.)
+        ///
+        const pool_allocator::stats_t& allocation_stats() const;
+
+        ///
+        /// Sets how aggressively compiled code is optimized. (0 disables the peephole pass.)
+        ///
+        void set_optimization_level(int level);
+
+        ///
+        /// Returns the sink print statements write to. It is flushed when the VM is destroyed.
+        ///
+        output_sink& output();
+
         interpret_result interpret(const std::string_view source);
+
+        ///
+        /// Compiles a source onto the end of the chunk without running it. On a compile error
+        /// the chunk is left as it was.
+        ///
+        bool compile(const std::string_view source);
+
+        ///
+        /// Runs the code in the chunk from an offset, which must start a compiled or loaded script.
+        ///
+        interpret_result execute(chunk::idx_t start);
     };
 }
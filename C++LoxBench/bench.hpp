@@ -0,0 +1,70 @@
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include "common.hpp"
+
+namespace lox::bench
+{
+    // Times each workload takes the fastest of, to keep one-off stalls out of the numbers.
+    constexpr int RUNS = 7;
+
+    ///
+    /// Runs a workload RUNS times and returns its fastest run in milliseconds.
+    ///
+    template <typename TWorkload>
+    double best_of(TWorkload workload)
+    {
+        auto best = std::chrono::duration<double, std::milli>::max();
+
+        for (int run = 0; run < RUNS; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            workload();
+
+            best = std::min<std::chrono::duration<double, std::milli>>(best, std::chrono::steady_clock::now() - start);
+        }
+
+        return best.count();
+    }
+
+    ///
+    /// Keeps the optimizer from dropping a result nothing else reads.
+    ///
+    template <typename T>
+    void keep(const T& value)
+    {
+        [[maybe_unused]] static volatile T sink;
+
+        sink = value;
+    }
+
+    ///
+    /// Returns the amount of checks that failed so far, for main's exit code.
+    ///
+    inline int& failed_checks()
+    {
+        static int failed = 0;
+
+        return failed;
+    }
+
+    ///
+    /// Reports whether something a workload relies on held, such as a container staying within bounds.
+    ///
+    inline void check(bool condition, std::string_view what)
+    {
+        std::cout << std::format("  {} {}\n", condition ? "ok    " : "FAILED", what);
+
+        if (!condition) ++failed_checks();
+    }
+
+    void run_interner_benchmarks();
+
+    void run_scanner_benchmarks();
+
+    void run_table_benchmarks();
+}
@@ -0,0 +1,54 @@
+
+#include <bit>
+
+#include "bench.hpp"
+#include "vm.hpp"
+
+namespace
+{
+    constexpr std::size_t ROUNDS = 200;
+
+    constexpr std::size_t STRINGS_PER_ROUND = 1'000;
+}
+
+///
+/// Interns STRINGS_PER_ROUND new strings nothing keeps alive, then collects, ROUNDS times.
+/// Returns the largest capacity the interner reached.
+///
+static std::size_t churn()
+{
+    lox::chunk chunk{};
+    lox::vm vm{ chunk };
+
+    std::size_t capacity = 0;
+
+    for (std::size_t round = 0; round < ROUNDS; ++round)
+    {
+        for (std::size_t i = 0; i < STRINGS_PER_ROUND; ++i)
+        {
+            vm.copy_string(std::format("temporary string {} of round {}", i, round));
+        }
+
+        vm.collect_garbage();
+
+        capacity = std::max(capacity, vm.interned_capacity());
+    }
+
+    return capacity;
+}
+
+void lox::bench::run_interner_benchmarks()
+{
+    std::cout << std::format("Interner churn, {} rounds of {} short-lived strings and a collection (best of {}):\n", ROUNDS, STRINGS_PER_ROUND, RUNS);
+
+    std::size_t capacity = 0;
+
+    const auto ms = best_of([&]() { capacity = churn(); });
+
+    std::cout << std::format("  {:<42} {:>8.1f} ms\n", "intern and collect", ms);
+
+    // At most one round's strings are alive at a time, so the interner never needs more slots than a
+    // table holding that many keys; the tombstones the collections leave must not add to it.
+    check(capacity <= std::bit_ceil(STRINGS_PER_ROUND * 8 / 3),
+        std::format("interner capacity peaks at {} slots after {} rounds", capacity, ROUNDS));
+}
@@ -0,0 +1,42 @@
+
+#include <map>
+
+#include "bench.hpp"
+
+int main(int argc, char* argv[])
+{
+    const std::map<std::string_view, void (*)()> benchmarks
+    {
+        { "interner", lox::bench::run_interner_benchmarks },
+        { "scanner", lox::bench::run_scanner_benchmarks },
+        { "table", lox::bench::run_table_benchmarks },
+    };
+
+    // With no arguments every benchmark runs; otherwise only the named ones.
+    if (argc == 1)
+    {
+        for (const auto& [name, benchmark] : benchmarks) benchmark();
+
+        return lox::bench::failed_checks() > 0 ? 1 : 0;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const auto benchmark = benchmarks.find(argv[i]);
+
+        if (benchmark == benchmarks.end())
+        {
+            std::cerr << std::format("Unknown benchmark \"{}\". Available:", argv[i]);
+
+            for (const auto& [name, _] : benchmarks) std::cerr << ' ' << name;
+
+            std::cerr << '\n';
+
+            return 64;
+        }
+
+        benchmark->second();
+    }
+
+    return lox::bench::failed_checks() > 0 ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+
+#include <random>
+#include <string>
+
+#include "bench.hpp"
+#include "scanner.hpp"
+
+namespace
+{
+    constexpr std::size_t SOURCE_SIZE = 16 * 1024 * 1024;
+
+    // Keywords and the identifiers that share a prefix with them, so both paths of the keyword trie are taken.
+    constexpr std::string_view WORDS[]
+    {
+        "and", "class", "else", "false", "for", "fun", "if", "nil", "or", "print", "return", "super", "this", "true", "var", "while",
+        "foo", "bar", "count", "index", "total", "format", "thing", "value", "result", "first", "fn", "a", "tmp", "self", "supper", "whiles", "orange", "iffy"
+    };
+}
+
+static void report(std::string_view workload, std::size_t tokens, std::size_t bytes, double ms)
+{
+    std::cout << std::format("  {:<42} {:>9} tokens, {:>8.1f} ms, {:>7.1f} MB/s\n", workload, tokens, ms, bytes / 1e3 / ms);
+}
+
+void lox::bench::run_scanner_benchmarks()
+{
+    std::mt19937 random{ 42 };
+
+    // Identifier-heavy source: words separated by spaces, with a newline every eight words or so.
+    std::string source;
+
+    while (source.size() < SOURCE_SIZE)
+    {
+        source += WORDS[random() % std::size(WORDS)];
+        source += random() % 8 == 0 ? '\n' : ' ';
+    }
+
+    std::cout << std::format("Scanner throughput on {} MB of identifiers and keywords (best of {}):\n", source.size() >> 20, RUNS);
+
+    std::size_t tokens = 0;
+
+    const auto streaming_ms = best_of([&]()
+    {
+        lox::scanner scanner{ source };
+
+        tokens = 0;
+
+        while (scanner.scan_token() != token_type::END_OF_FILE) ++tokens;
+    });
+
+    report("scan_token until END_OF_FILE", tokens, source.size(), streaming_ms);
+
+    const auto buffered_ms = best_of([&]()
+    {
+        const lox::token_buffer buffer{ source };
+
+        // Not counting the END_OF_FILE token, like the loop above.
+        tokens = buffer.count() - 1;
+    });
+
+    report("token_buffer of the whole source", tokens, source.size(), buffered_ms);
+}
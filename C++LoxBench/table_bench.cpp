@@ -0,0 +1,201 @@
+
+#include <bit>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.hpp"
+#include "table.hpp"
+
+namespace
+{
+    constexpr std::size_t KEY_COUNT = 200'000;
+
+    constexpr int LOOKUP_ROUNDS = 10;
+
+    constexpr int INSERT_ROUNDS = 5;
+
+    constexpr std::size_t HOT_KEY_COUNT = 1'000;
+
+    constexpr std::size_t HOT_LOOKUPS = 2'000'000;
+
+    constexpr std::size_t CHURN_CYCLES = 200'000;
+
+    // Keys that stay in the table while others come and go, like the live strings of the interner.
+    constexpr std::size_t CHURN_LIVE_KEYS = 1'000;
+
+    // Adapters over the two containers' slightly different interfaces.
+
+    template <typename TKey, typename THash>
+    bool insert(lox::table<TKey, std::size_t, THash>& map, const TKey& key, std::size_t value)
+    {
+        return map.try_emplace(key, value).second;
+    }
+
+    template <typename TKey, typename THash>
+    bool insert(std::unordered_map<TKey, std::size_t, THash>& map, const TKey& key, std::size_t value)
+    {
+        return map.try_emplace(key, value).second;
+    }
+
+    template <typename TKey, typename THash>
+    std::size_t lookup(const lox::table<TKey, std::size_t, THash>& map, const TKey& key)
+    {
+        const auto* value = map.find(key);
+
+        return value ? *value : 0;
+    }
+
+    template <typename TKey, typename THash>
+    std::size_t lookup(const std::unordered_map<TKey, std::size_t, THash>& map, const TKey& key)
+    {
+        const auto entry = map.find(key);
+
+        return entry != map.end() ? entry->second : 0;
+    }
+}
+
+///
+/// Inserts every key, then looks them all up LOOKUP_ROUNDS times in another order.
+///
+template <typename TMap, typename TKey>
+static double insert_then_lookup(const std::vector<TKey>& keys, const std::vector<TKey>& lookups)
+{
+    return lox::bench::best_of([&]()
+    {
+        TMap map;
+
+        for (std::size_t i = 0; i < keys.size(); ++i) insert(map, keys[i], i);
+
+        std::size_t sum = 0;
+
+        for (int round = 0; round < LOOKUP_ROUNDS; ++round)
+        {
+            for (const auto& key : lookups) sum += lookup(map, key);
+        }
+
+        lox::bench::keep(sum);
+    });
+}
+
+///
+/// Fills INSERT_ROUNDS fresh maps with every key, growing them from empty each time.
+///
+template <typename TMap, typename TKey>
+static double insert_only(const std::vector<TKey>& keys)
+{
+    return lox::bench::best_of([&]()
+    {
+        for (int round = 0; round < INSERT_ROUNDS; ++round)
+        {
+            TMap map;
+
+            for (std::size_t i = 0; i < keys.size(); ++i) insert(map, keys[i], i);
+
+            lox::bench::keep(lookup(map, keys.front()));
+        }
+    });
+}
+
+///
+/// Looks up a small, cache-resident set of keys many times, like the globals of a hot loop.
+///
+template <typename TMap, typename TKey>
+static double hot_lookups(const std::vector<TKey>& keys)
+{
+    TMap map;
+
+    for (std::size_t i = 0; i < HOT_KEY_COUNT; ++i) insert(map, keys[i], i);
+
+    return lox::bench::best_of([&]()
+    {
+        std::size_t sum = 0;
+
+        for (std::size_t i = 0; i < HOT_LOOKUPS; ++i) sum += lookup(map, keys[i % HOT_KEY_COUNT]);
+
+        lox::bench::keep(sum);
+    });
+}
+
+///
+/// Inserts and erases a fresh key CHURN_CYCLES times next to CHURN_LIVE_KEYS keys that stay, and
+/// returns the capacity the table ends with. Every cycle leaves a tombstone behind.
+///
+static std::size_t churn(const std::vector<const int*>& keys, const std::vector<const int*>& transient)
+{
+    lox::table<const int*, std::size_t, std::hash<const int*>> map;
+
+    for (std::size_t i = 0; i < CHURN_LIVE_KEYS; ++i) insert(map, keys[i], i);
+
+    for (std::size_t i = 0; i < CHURN_CYCLES; ++i)
+    {
+        const auto* key = transient[i % transient.size()];
+
+        insert(map, key, i);
+        map.erase(key);
+    }
+
+    return map.capacity();
+}
+
+static void report(std::string_view workload, double table_ms, double unordered_map_ms)
+{
+    std::cout << std::format("  {:<42} table {:>8.1f} ms, unordered_map {:>8.1f} ms\n", workload, table_ms, unordered_map_ms);
+}
+
+void lox::bench::run_table_benchmarks()
+{
+    std::mt19937_64 random{ 42 };
+
+    // Identifier-like strings, as the interners and the global index see them.
+    std::vector<std::string> texts;
+
+    for (std::size_t i = 0; i < KEY_COUNT; ++i) texts.push_back(std::format("identifier_{}_{}", i, random() % 1000));
+
+    std::vector<std::string_view> strings{ texts.begin(), texts.end() };
+
+    // Addresses of separate heap blocks, as object pointers are.
+    std::vector<std::unique_ptr<int>> objects;
+
+    for (std::size_t i = 0; i < KEY_COUNT; ++i) objects.push_back(std::make_unique<int>(static_cast<int>(i)));
+
+    std::vector<const int*> pointers;
+
+    for (const auto& object : objects) pointers.push_back(object.get());
+
+    auto shuffled_strings = strings;
+    auto shuffled_pointers = pointers;
+
+    std::shuffle(shuffled_strings.begin(), shuffled_strings.end(), random);
+    std::shuffle(shuffled_pointers.begin(), shuffled_pointers.end(), random);
+
+    using string_table = lox::table<std::string_view, std::size_t, lox::string_hash>;
+    using string_map   = std::unordered_map<std::string_view, std::size_t, std::hash<std::string_view>>;
+
+    using pointer_table = lox::table<const int*, std::size_t, std::hash<const int*>>;
+    using pointer_map   = std::unordered_map<const int*, std::size_t, std::hash<const int*>>;
+
+    std::cout << std::format("lox::table vs std::unordered_map, {} keys, lookups in shuffled order (best of {}):\n", KEY_COUNT, RUNS);
+
+    report(std::format("string_view keys, insert + {}x lookup", LOOKUP_ROUNDS),
+        insert_then_lookup<string_table>(strings, shuffled_strings),
+        insert_then_lookup<string_map>(strings, shuffled_strings));
+
+    report(std::format("pointer keys, insert + {}x lookup", LOOKUP_ROUNDS),
+        insert_then_lookup<pointer_table>(pointers, shuffled_pointers),
+        insert_then_lookup<pointer_map>(pointers, shuffled_pointers));
+
+    report(std::format("pointer keys, {}x insert only", INSERT_ROUNDS),
+        insert_only<pointer_table>(pointers),
+        insert_only<pointer_map>(pointers));
+
+    report(std::format("{} pointer keys, {} lookups", HOT_KEY_COUNT, HOT_LOOKUPS),
+        hot_lookups<pointer_table>(shuffled_pointers),
+        hot_lookups<pointer_map>(shuffled_pointers));
+
+    // Live keys need at most 1 / (MAX_LOAD / 2) slots each, rounded up to a power of two; tombstones add nothing.
+    const auto capacity = churn(pointers, { pointers.begin() + CHURN_LIVE_KEYS, pointers.end() });
+
+    check(capacity <= std::bit_ceil(CHURN_LIVE_KEYS * 8 / 3),
+        std::format("{} insert/erase cycles next to {} live keys end at {} slots", CHURN_CYCLES, CHURN_LIVE_KEYS, capacity));
+}